@@ -6,7 +6,10 @@ static const unsigned int borderpx  = 1;        //!< border pixel of windows
 static const unsigned int snap      = 32;       //!< snap pixel
 static const int showbar            = 1;        //!< 0 means no bar
 static const int topbar             = 1;        //!< 0 means bottom bar
+static const int showstats          = 0;        //!< 1 means print startup time, and performance counters on exit
+static const unsigned int statsinterval = 0;    //!< if showstats, also print them every this many seconds
 static const char *fonts[]          = { "monospace:size=10" };
+static const unsigned int maxfallbackfonts = 8; //!< fonts kept open for characters missing from fonts, least recently used ones are closed (0 means no limit)
 static const char dmenufont[]       = "monospace:size=10";
 static const char col_gray1[]       = "#222222";
 static const char col_gray2[]       = "#444444";
@@ -36,6 +39,7 @@ static const Rule rules[] = {
 static const float mfact     = 0.55; //!< factor of master area size [0.05..0.95]
 static const int nmaster     = 1;    //!< number of clients in master area
 static const int resizehints = 1;    //!< 1 means respect size hints in tiled resizals
+static const int lazymonocle = 0;    //!< 1 means monocle only maximizes the selected client, when selected
 
 static const Layout layouts[] = {
 	/* symbol     arrange function */
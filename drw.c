@@ -1,5 +1,6 @@
 /*! \file drw.c
  * See LICENSE file for copyright and license details. */
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -77,8 +78,81 @@ static size_t utf8decode(const char* c, long* u, size_t clen) {
 	return len;
 }
 
+static void dropglyphs(Drw* drw, int draw) {
+	/*! \brief Empty the glyph batches of a drawing context.
+	 * \param drw [in] Drawing context.
+	 * \param draw [in] Whether to draw the glyphs into the selected buffer first.
+	 * \sa drw_flush()
+  **/
+
+	Batch* b;
+	Buf* buf = drw->buf;
+
+	for (b = drw->batches; b < drw->batches + NBATCHES; b++) {
+		if (draw && b->n && buf && buf->drawable) {
+			if (!buf->xftdraw)
+				buf->xftdraw = XftDrawCreate(drw->dpy, buf->drawable,
+				                             DefaultVisual(drw->dpy, drw->screen),
+				                             DefaultColormap(drw->dpy, drw->screen));
+			XftDrawGlyphFontSpec(buf->xftdraw, b->color, b->specs, b->n); //a single submission per color
+		}
+		b->color = NULL;
+		b->n = 0;
+	}
+	drw->npending = 0;
+}
+
+static void flushover(Drw* drw, int x, int y, unsigned int w, unsigned int h) {
+	/*! \brief Draw pending glyphs if they overlap an area about to be drawn over.
+	 *
+	 * Core drawing requests are not batched, so they must not overtake
+	 * glyphs they should cover.
+  **/
+
+	XRectangle* r;
+
+	for (r = drw->pending; r < drw->pending + drw->npending; r++)
+		if (x < r->x + r->width && r->x < x + (int) w && y < r->y + r->height && r->y < y + (int) h) {
+			dropglyphs(drw, 1);
+			return;
+		}
+}
+
+static void queueglyph(Drw* drw, const Clr* color, Fnt* font, FT_UInt glyph, int x, int y) {
+	/*! \brief Add a glyph to the batch of its color, to be drawn by drw_flush().
+  **/
+
+	Batch* b, *empty = NULL;
+	XftGlyphFontSpec* specs;
+
+	for (b = drw->batches; b < drw->batches + NBATCHES && b->color != color; b++)
+		if (!b->color && !empty)
+			empty = b;
+	if (b == drw->batches + NBATCHES) { //a new color
+		if (!empty) { //no room for it
+			dropglyphs(drw, 1);
+			empty = drw->batches;
+		}
+		b = empty;
+		b->color = color;
+	}
+	if (b->n == b->size) {
+		b->size = MAX(64, 2 * b->size);
+		specs = ecalloc(b->size, sizeof(XftGlyphFontSpec));
+		if (b->n)
+			memcpy(specs, b->specs, b->n * sizeof(XftGlyphFontSpec));
+		free(b->specs);
+		b->specs = specs;
+	}
+	b->specs[b->n++] = (XftGlyphFontSpec) {font->xfont, glyph, x, y};
+}
+
 Drw* drw_create(Display* dpy, int screen, Window root, unsigned int w, unsigned int h) {
 	/*! \brief Create drawing context.
+	 *
+	 * If w and h are both nonzero, a drawable of that size is created and
+	 * selected; otherwise, a buffer must be selected with drw_setbuf() before
+	 * drawing.
   **/
 
 	Drw* drw = ecalloc(1, sizeof(Drw));
@@ -86,9 +160,12 @@ Drw* drw_create(Display* dpy, int screen, Window root, unsigned int w, unsigned
 	drw->dpy = dpy;
 	drw->screen = screen;
 	drw->root = root;
-	drw->w = w;
-	drw->h = h;
-	drw->drawable = XCreatePixmap(dpy, root, w, h, DefaultDepth(dpy, screen)); //create pixmap with given parameters
+	if (w && h) {
+		drw->own.w = w;
+		drw->own.h = h;
+		drw->own.drawable = XCreatePixmap(dpy, root, w, h, DefaultDepth(dpy, screen)); //create pixmap with given parameters
+		drw_setbuf(drw, &drw->own);
+	}
 	drw->gc = XCreateGC(dpy, root, 0, NULL); //create graphics context
 	XSetLineAttributes(dpy, drw->gc, 1, LineSolid, CapButt, JoinMiter); //configure how lines will look like
 
@@ -96,28 +173,105 @@ Drw* drw_create(Display* dpy, int screen, Window root, unsigned int w, unsigned
 }
 
 void drw_resize(Drw* drw, unsigned int w, unsigned int h) {
-	/*! \brief Resize a given drawing context.
+	/*! \brief Resize the drawable owned by a given drawing context.
   **/
 
 	if (!drw)
 		return;
 
-	drw->w = w;
-	drw->h = h;
-	if (drw->drawable)
-		XFreePixmap(drw->dpy, drw->drawable);
-	drw->drawable = XCreatePixmap(drw->dpy, drw->root, w, h, DefaultDepth(drw->dpy, drw->screen));
+	drw_buf_resize(drw, &drw->own, w, h);
 }
 
 void drw_free(Drw* drw) {
 	/*! \brief Destroy a drawing context.
+	 *
+	 * Buffers created with drw_buf_create() must be freed separately.
   **/
 
-	XFreePixmap(drw->dpy, drw->drawable);
+	size_t i;
+
+	if (drw->own.xftdraw)
+		XftDrawDestroy(drw->own.xftdraw);
+	if (drw->own.drawable)
+		XFreePixmap(drw->dpy, drw->own.drawable);
 	XFreeGC(drw->dpy, drw->gc);
+	for (i = 0; i < NBATCHES; i++)
+		free(drw->batches[i].specs);
+	free(drw->pending);
+	for (i = 0; i < SHAPECACHESIZE; i++) {
+		free(drw->shapes[i].text);
+		free(drw->shapes[i].runs);
+		free(drw->shapes[i].chars);
+	}
+	free(drw->fontv);
+	free(drw->bmpfonts);
+	for (i = 0; i < MATCHSIZE; i++)
+		if (drw->matches[i].match)
+			FcPatternDestroy(drw->matches[i].match);
 	free(drw);
 }
 
+Buf* drw_buf_create(Drw* drw, unsigned int w, unsigned int h) {
+	/*! \brief Create an offscreen buffer to draw into.
+	 * \param drw [in] Drawing context.
+	 * \param w [in] Buffer width, nonzero.
+	 * \param h [in] Buffer height, nonzero.
+	 * \return The new buffer, to be selected with drw_setbuf().
+  **/
+
+	Buf* buf = ecalloc(1, sizeof(Buf));
+
+	buf->w = w;
+	buf->h = h;
+	buf->drawable = XCreatePixmap(drw->dpy, drw->root, w, h, DefaultDepth(drw->dpy, drw->screen));
+
+	return buf;
+}
+
+void drw_buf_free(Drw* drw, Buf* buf) {
+	/*! \brief Destroy a buffer created with drw_buf_create().
+	 *
+	 * If the buffer is selected, glyphs not yet drawn into it are dropped,
+	 * and the drawing context goes back to its own drawable, if any.
+  **/
+
+	if (!buf)
+		return;
+
+	if (drw->buf == buf) {
+		dropglyphs(drw, 0);
+		drw_setbuf(drw, &drw->own);
+	}
+	if (buf->xftdraw)
+		XftDrawDestroy(buf->xftdraw);
+	XFreePixmap(drw->dpy, buf->drawable);
+	if (buf != &drw->own)
+		free(buf);
+}
+
+void drw_buf_resize(Drw* drw, Buf* buf, unsigned int w, unsigned int h) {
+	/*! \brief Resize a buffer, discarding its contents.
+	 *
+	 * Nothing is done if the size does not change.
+  **/
+
+	int selected = drw->buf == buf || !drw->buf;
+
+	if (buf->drawable && buf->w == w && buf->h == h)
+		return;
+	if (drw->buf == buf)
+		dropglyphs(drw, 0); //would be lost anyway
+	if (buf->drawable)
+		XFreePixmap(drw->dpy, buf->drawable);
+	buf->w = w;
+	buf->h = h;
+	buf->drawable = XCreatePixmap(drw->dpy, drw->root, w, h, DefaultDepth(drw->dpy, drw->screen));
+	if (buf->xftdraw)
+		XftDrawChange(buf->xftdraw, buf->drawable); //keep the same XftDraw
+	if (selected)
+		drw_setbuf(drw, buf);
+}
+
 static Fnt* xfont_create(Drw* drw, const char* fontname, FcPattern* fontpattern) {
 	/*! \brief Create a font from either name or pattern.
 	 *
@@ -128,6 +282,7 @@ static Fnt* xfont_create(Drw* drw, const char* fontname, FcPattern* fontpattern)
 	Fnt* font;
 	XftFont* xfont = NULL;
 	FcPattern* pattern = NULL;
+	XGlyphInfo ext;
 
 	if (fontname) { //use name
 		/* Using the pattern found at font->xfont->pattern does not yield the
@@ -158,6 +313,9 @@ static Fnt* xfont_create(Drw* drw, const char* fontname, FcPattern* fontpattern)
 	font->pattern = pattern;
 	font->h = xfont->ascent + xfont->descent;
 	font->dpy = drw->dpy;
+	font->dot = XftCharIndex(drw->dpy, xfont, '.');
+	XftGlyphExtents(drw->dpy, xfont, &font->dot, 1, &ext);
+	font->ellipsisw = 3 * ext.xOff;
 
 	return font;
 }
@@ -166,16 +324,24 @@ static void xfont_free(Fnt* font) {
 	/*! \brief Destroy a font.
   **/
 
+	unsigned int i;
+
 	if (!font)
 		return;
+	for (i = 0; i < sizeof font->seen / sizeof *font->seen; i++)
+		free(font->seen[i]);
 	if (font->pattern)
 		FcPatternDestroy(font->pattern);
 	XftFontClose(font->dpy, font->xfont);
 	free(font);
 }
 
-Fnt* drw_fontset_create(Drw* drw, const char* fonts[], size_t fontcount) {
+Fnt* drw_fontset_create(Drw* drw, const char* fonts[], size_t fontcount, unsigned int maxfallback) {
 	/*! \brief Create a linked list of fonts and associates it with a drawing context.
+	 * \param drw [in] Drawing context.
+	 * \param fonts [in] Font names.
+	 * \param fontcount [in] Number of elements in fonts.
+	 * \param maxfallback [in] Maximum number of fallback fonts drw_text() keeps open for characters missing from these, 0 for no limit.
   **/
 
 	Fnt* cur, *ret = NULL;
@@ -184,15 +350,36 @@ Fnt* drw_fontset_create(Drw* drw, const char* fonts[], size_t fontcount) {
 	if (!drw || !fonts)
 		return NULL;
 
+	drw->npinned = 0;
 	for (i = 1; i <= fontcount; i++) {
 		if ((cur = xfont_create(drw, fonts[fontcount - i], NULL))) {
 			cur->next = ret;
 			ret = cur;
+			drw->npinned++;
 		}
 	}
+	drw->maxfallback = maxfallback;
+	drw->fontgen++;
 	return (drw->fonts = ret);
 }
 
+void drw_fontset_getstats(Drw* drw, unsigned int* n, unsigned long* bytes) {
+	/*! \brief Get the resources used by the fontset of a drawing context.
+	 * \param drw [in] Drawing context.
+	 * \param n [out] Number of open fonts, fallback fonts included.
+	 * \param bytes [out] Estimated size of their glyph caches, assuming one 8-bit image per character drawn.
+  **/
+
+	Fnt* f;
+
+	*n = 0;
+	*bytes = 0;
+	for (f = drw->fonts; f; f = f->next) {
+		(*n)++;
+		*bytes += (unsigned long) f->nglyphs * f->h * ((f->xfont->max_advance_width + 3) & ~3); //rows are padded to 4 bytes
+	}
+}
+
 void drw_fontset_free(Fnt* set) {
 	/*! \brief Destroy a fontset.
   **/
@@ -239,8 +426,33 @@ void drw_setfontset(Drw* drw, Fnt* set) {
 	/*! \brief Set the fontset for a drawing context.
   **/
 
-	if (drw)
+	Fnt* f;
+
+	if (drw) {
 		drw->fonts = set;
+		for (drw->npinned = 0, f = set; f; f = f->next) //none of them are fallback fonts
+			drw->npinned++;
+		drw->fontgen++;
+	}
+}
+
+void drw_setbuf(Drw* drw, Buf* buf) {
+	/*! \brief Select the buffer that drawing functions draw into.
+	 * \param drw [in] Drawing context.
+	 * \param buf [in] Buffer from drw_buf_create(), or the context's own.
+	 *
+	 * Glyphs drawn into the previously selected buffer are flushed.
+  **/
+
+	if (!drw)
+		return;
+
+	if (drw->buf != buf)
+		drw_flush(drw);
+	drw->buf = buf;
+	drw->drawable = buf->drawable;
+	drw->w = buf->w;
+	drw->h = buf->h;
 }
 
 void drw_setscheme(Drw* drw, Clr* scm) {
@@ -264,6 +476,7 @@ void drw_rect(Drw* drw, int x, int y, unsigned int w, unsigned int h, int filled
 
 	if (!drw || !drw->scheme)
 		return;
+	flushover(drw, x, y, w, h);
 	XSetForeground(drw->dpy, drw->gc, invert ? drw->scheme[ColBg].pixel : drw->scheme[ColFg].pixel);
 	if (filled)
 		XFillRectangle(drw->dpy, drw->drawable, drw->gc, x, y, w, h);
@@ -271,6 +484,299 @@ void drw_rect(Drw* drw, int x, int y, unsigned int w, unsigned int h, int filled
 		XDrawRectangle(drw->dpy, drw->drawable, drw->gc, x, y, w - 1, h - 1);
 }
 
+static void resetmatches(Drw* drw) {
+	/*! \brief Forget the results of all fontconfig searches.
+	 * \sa findfont()
+  **/
+
+	unsigned int i;
+
+	for (i = 0; i < MATCHSIZE; i++)
+		if (drw->matches[i].match)
+			FcPatternDestroy(drw->matches[i].match);
+	memset(drw->matches, 0, sizeof drw->matches);
+	drw->nmatches = 0;
+	drw->matchbase = drw->fonts;
+}
+
+static void evictfont(Drw* drw) {
+	/*! \brief Close the least recently used fallback font, if there are Drw::maxfallback of them.
+	 *
+	 * The first Drw::npinned fonts are never closed, nor are those used by
+	 * the text being shaped (see Drw::keeptick), even if that leaves more
+	 * fallback fonts open.
+	 * \sa findfont()
+  **/
+
+	Fnt* f, *prev, *lru = NULL, *lruprev = NULL;
+	unsigned int n;
+
+	if (!drw->maxfallback)
+		return;
+	for (n = 0, prev = NULL, f = drw->fonts; f; prev = f, f = f->next, n++)
+		if (n >= drw->npinned && f->used <= drw->keeptick && (!lru || f->used < lru->used)) {
+			lru = f;
+			lruprev = prev;
+		}
+	if (!lru || n - drw->npinned < drw->maxfallback)
+		return;
+	if (lruprev)
+		lruprev->next = lru->next;
+	else
+		drw->fonts = lru->next;
+	dropglyphs(drw, 1); //queued glyphs may still refer to it
+	xfont_free(lru);
+	drw->fontgen++; //cached runs and characters may refer to it
+}
+
+static Fnt* findfont(Drw* drw, long codepoint) {
+	/*! \brief Find the font a character is drawn with, without using the cache.
+	 * \param drw [in] Drawing context.
+	 * \param codepoint [in] Unicode character.
+	 * \return The first font in the fontset that has the character. If none has it, fontconfig is asked for a fallback font, which is appended to the fontset, possibly closing another one (see evictfont()). If that fails too, the first font.
+	 *
+	 * Fontconfig results, including failures, are remembered in Drw::matches
+	 * until the first font changes, so each character is searched for once.
+  **/
+
+	Fnt* curfont, *usedfont;
+	FcCharSet* fccharset;
+	FcPattern* fcpattern;
+	FcPattern* match;
+	XftResult result;
+	MatchSlot* ms;
+	unsigned int i;
+
+	for (curfont = drw->fonts; curfont; curfont = curfont->next) //try all fonts in order
+		if (XftCharExists(drw->dpy, curfont->xfont, codepoint))
+			return curfont;
+
+	if (drw->matchbase != drw->fonts || drw->nmatches >= MATCHSIZE / 2) //searched with another pattern, or full
+		resetmatches(drw);
+	for (i = codepoint & (MATCHSIZE - 1); drw->matches[i].codepoint && drw->matches[i].codepoint != codepoint; i = (i + 1) & (MATCHSIZE - 1))
+		; /* NOP */
+	ms = &drw->matches[i];
+	if (ms->codepoint) { //searched before
+		drw->matchhits++;
+		if (!ms->match)
+			return drw->fonts; //and nothing was found
+		match = ms->match;
+	} else {
+		drw->matchmisses++;
+		fccharset = FcCharSetCreate();
+		FcCharSetAddChar(fccharset, codepoint); //add the problematic character
+
+		if (!drw->fonts->pattern) {
+			/* Refer to the comment in xfont_create for more information. */
+			die("the first font in the cache must be loaded from a font string.");
+		}
+
+		fcpattern = FcPatternDuplicate(drw->fonts->pattern); //use the default font pattern
+		FcPatternAddCharSet(fcpattern, FC_CHARSET, fccharset); //but must contain the desired character
+		FcPatternAddBool(fcpattern, FC_SCALABLE, FcTrue); //also must be scalable
+
+		FcConfigSubstitute(NULL, fcpattern, FcMatchPattern); //substitute pattern using default configuration
+		FcDefaultSubstitute(fcpattern); //substitute default values for nonspecified font patterns
+		match = XftFontMatch(drw->dpy, drw->screen, fcpattern, &result); //get matching font
+
+		FcCharSetDestroy(fccharset);
+		FcPatternDestroy(fcpattern);
+
+		ms->codepoint = codepoint;
+		ms->match = match;
+		drw->nmatches++;
+	}
+
+	if (match) {
+		FcPatternReference(match); //the font takes one reference, the cache keeps another
+		usedfont = xfont_create(drw, NULL, match); //make font that matches pattern
+		if (usedfont && XftCharExists(drw->dpy, usedfont->xfont, codepoint)) {
+			evictfont(drw); //make room for it
+			for (curfont = drw->fonts; curfont->next; curfont = curfont->next) //find last font
+				; /* NOP */
+			curfont->next = usedfont; //add new font at the end
+			drw->fontgen++;
+			return usedfont;
+		}
+		if (usedfont)
+			xfont_free(usedfont);
+		else
+			FcPatternDestroy(match); //the font did not take its reference
+		FcPatternDestroy(ms->match); //remember the failure instead
+		ms->match = NULL;
+	}
+	return drw->fonts; //use default font instead
+}
+
+static void resetmap(Drw* drw) {
+	/*! \brief Forget the font of every character, after the fontset changed.
+	 * \sa fontfor()
+  **/
+
+	Fnt* f;
+	unsigned int n;
+
+	if (!drw->bmpfonts)
+		drw->bmpfonts = ecalloc(0x10000, 1);
+	else
+		memset(drw->bmpfonts, 0, 0x10000);
+	memset(drw->astral, 0, sizeof drw->astral);
+	drw->nastral = 0;
+	for (n = 0, f = drw->fonts; f && n < 255; f = f->next) //fonts past 255 are never cached
+		n++;
+	free(drw->fontv);
+	drw->fontv = ecalloc(MAX(n, 1), sizeof(Fnt*));
+	for (drw->nfontv = 0, f = drw->fonts; drw->nfontv < n; f = f->next)
+		drw->fontv[drw->nfontv++] = f;
+	drw->mapgen = drw->fontgen;
+}
+
+static Fnt* fontfor(Drw* drw, long codepoint) {
+	/*! \brief Find the font a character is drawn with.
+	 * \param drw [in] Drawing context.
+	 * \param codepoint [in] Unicode character.
+	 * \return The same font as findfont().
+	 *
+	 * Results are remembered in Drw::bmpfonts or Drw::astral until the
+	 * fontset changes, so each character needs a single lookup.
+  **/
+
+	unsigned char* slot, **p;
+	CharSlot* cs = NULL;
+	Fnt* font;
+	unsigned int i;
+
+	if (!drw->bmpfonts || drw->mapgen != drw->fontgen)
+		resetmap(drw);
+	if (codepoint < 0x10000) {
+		slot = &drw->bmpfonts[codepoint];
+	} else {
+		if (drw->nastral >= ASTRALSIZE / 2) { //start over rather than grow
+			memset(drw->astral, 0, sizeof drw->astral);
+			drw->nastral = 0;
+		}
+		for (i = codepoint & (ASTRALSIZE - 1); drw->astral[i].font && drw->astral[i].codepoint != codepoint; i = (i + 1) & (ASTRALSIZE - 1))
+			; /* NOP */
+		cs = &drw->astral[i];
+		slot = &cs->font;
+	}
+	if (*slot) {
+		drw->charhits++;
+		font = drw->fontv[*slot - 1];
+		font->used = ++drw->fonttick;
+		return font;
+	}
+
+	drw->charmisses++;
+	font = findfont(drw, codepoint);
+	font->used = ++drw->fonttick;
+	p = &font->seen[codepoint >> 16];
+	if (!*p)
+		*p = ecalloc(0x10000 / 8, 1);
+	if (!((*p)[(codepoint & 0xFFFF) / 8] & 1 << (codepoint & 7))) { //count it only the first time, lookups are repeated after resetmap()
+		(*p)[(codepoint & 0xFFFF) / 8] |= 1 << (codepoint & 7);
+		font->nglyphs++;
+	}
+	if (drw->mapgen != drw->fontgen) //a fallback font was added, all slots will be cleared
+		return font;
+	for (i = 0; i < drw->nfontv && drw->fontv[i] != font; i++) //get font index
+		; /* NOP */
+	if (i < drw->nfontv) {
+		*slot = i + 1;
+		if (cs) {
+			cs->codepoint = codepoint;
+			drw->nastral++;
+		}
+	}
+	return font;
+}
+
+static Shape* shapetext(Drw* drw, const char* text) {
+	/*! \brief Split a text into runs of characters drawn with the same font.
+	 * \param drw [in] Drawing context.
+	 * \param text [in] UTF-8 encoded string.
+	 * \return Runs of the text, valid until the next call.
+	 *
+	 * The advance of each character is measured once, and stored as a prefix
+	 * sum in Shape::chars so any part of the text can be measured without
+	 * asking Xft again.
+	 *
+	 * Results are cached in Drw::shapes, keyed by the text and Drw::fontgen;
+	 * on a miss the least recently used entry is replaced.
+  **/
+
+	uint64_t hash = 14695981039346656037ULL; //FNV-1a
+	const char* p;
+	Shape* s, *lru = drw->shapes;
+	Run* runs;
+	CharPos* g;
+	Fnt* font;
+	FT_UInt index;
+	XGlyphInfo ext;
+	long codepoint;
+	size_t i, n, len;
+
+	for (p = text; *p; p++)
+		hash = (hash ^ (unsigned char) *p) * 1099511628211ULL;
+	hash |= !hash; //0 marks unused entries
+	len = p - text;
+	for (i = 0; i < SHAPECACHESIZE; i++) {
+		s = &drw->shapes[i];
+		if (s->hash == hash && s->gen == drw->fontgen && !strcmp(s->text, text)) {
+			s->used = ++drw->shapetick;
+			drw->shapehits++;
+			return s;
+		}
+		if (s->used < lru->used)
+			lru = s;
+	}
+	drw->shapemisses++;
+
+	s = lru;
+	free(s->text);
+	s->text = ecalloc(len + 1, 1);
+	memcpy(s->text, text, len);
+	s->nruns = 0;
+	s->nchars = 0;
+	if (len + 1 > s->charsize) { //there are at most as many characters as bytes
+		free(s->chars);
+		s->charsize = len + 1;
+		s->chars = ecalloc(s->charsize, sizeof(CharPos));
+	}
+	g = s->chars;
+	g[0].x = 0;
+	drw->keeptick = drw->fonttick; //runs must not lose their fonts
+	for (i = 0; i < len; i += n) { //assign a font to every character, and measure it
+		n = utf8decode(text + i, &codepoint, UTF_SIZ);
+		font = fontfor(drw, codepoint);
+		if (!s->nruns || s->runs[s->nruns - 1].font != font) { //start a new run
+			if (s->nruns == s->runsize) {
+				s->runsize = MAX(8, 2 * s->runsize);
+				runs = ecalloc(s->runsize, sizeof(Run));
+				if (s->nruns)
+					memcpy(runs, s->runs, s->nruns * sizeof(Run));
+				free(s->runs);
+				s->runs = runs;
+			}
+			s->runs[s->nruns++] = (Run) {font, s->nchars, 0};
+		}
+		s->runs[s->nruns - 1].n++;
+		index = XftCharIndex(drw->dpy, font->xfont, codepoint);
+		XftGlyphExtents(drw->dpy, font->xfont, &index, 1, &ext);
+		g[s->nchars].off = i;
+		g[s->nchars].glyph = index;
+		g[s->nchars + 1].x = g[s->nchars].x + ext.xOff;
+		s->nchars++;
+	}
+	g[s->nchars].off = len;
+	s->w = g[s->nchars].x;
+	s->hash = hash;
+	s->gen = drw->fontgen; //after any fallback font was added
+	s->used = ++drw->shapetick;
+
+	return s;
+}
+
 int drw_text(Drw* drw, int x, int y, unsigned int w, unsigned int h, unsigned int lpad, const char* text, int invert) {
 	/*! \brief Draw text, or measure its width without drawing.
 	 * \param drw [in] Drawing context.
@@ -282,133 +788,94 @@ int drw_text(Drw* drw, int x, int y, unsigned int w, unsigned int h, unsigned in
 	 * \param text [in] UTF-8 encoded string of text to be drawn.
 	 * \param invert [in] Invert foreground and background colors.
 	 * \return The specified width. If x = y = w = h = 0, nothing will be drawn, and the actual width will be returned.
+	 *
+	 * Each chunk of text is drawn with the first font that supports it,
+	 * see shapetext(). Text that does not fit is cut after the last whole
+	 * character that leaves room for an ellipsis.
+	 *
+	 * The background is filled right away, but glyphs are only queued, to be
+	 * drawn along with those of other calls by drw_flush().
   **/
 
-	char buf[1024];
-	int ty;
+	int ty, x0, end;
 	unsigned int ew;
-	XftDraw* d = NULL;
-	Fnt* usedfont, *curfont, *nextfont;
-	size_t i, len;
-	int utf8strlen, utf8charlen, render = x || y || w || h; //all set to 0 means only get width, don't render
-	long utf8codepoint = 0;
-	const char* utf8str;
-	FcCharSet* fccharset;
-	FcPattern* fcpattern;
-	FcPattern* match;
-	XftResult result;
-	int charexists = 0;
+	const Clr* color;
+	Shape* s;
+	Run* r;
+	CharPos* g;
+	size_t i, k, lo, hi;
+	XRectangle* pending;
+	int render = x || y || w || h; //all set to 0 means only get width, don't render
 
 	if (!drw || (render && !drw->scheme) || !text || !drw->fonts)
 		return 0;
 
-	if (!render) {
-		w = ~w; //set width to highest possible value so that all text is measured, with no limit
-	} else {
-		XSetForeground(drw->dpy, drw->gc, drw->scheme[invert ? ColFg : ColBg].pixel); //set foreground for GC
-		XFillRectangle(drw->dpy, drw->drawable, drw->gc, x, y, w, h); //fill rectangle around text
-		d = XftDrawCreate(drw->dpy, drw->drawable,
-		                  DefaultVisual(drw->dpy, drw->screen),
-		                  DefaultColormap(drw->dpy, drw->screen));
-		x += lpad;
-		w -= lpad;
-	}
-
-	usedfont = drw->fonts; //use first font in linked list
-	while (1) { //draw each chunk of text with the first font that supports it
-		utf8strlen = 0;
-		utf8str = text; //draw from where last iteration finished
-		nextfont = NULL;
-		while (*text) { //scan text to find largest chunk of it that can be rendered with the current font
-			utf8charlen = utf8decode(text, &utf8codepoint, UTF_SIZ); //get one UTF-8 character
-			for (curfont = drw->fonts; curfont; curfont = curfont->next) { //try all fonts in order
-				charexists = charexists || XftCharExists(drw->dpy, curfont->xfont, utf8codepoint); //does character exist in font?
-				if (charexists) {
-					if (curfont == usedfont) { //the font we are using is the first that has this character
-						utf8strlen += utf8charlen;
-						text += utf8charlen; //advance to next UTF-8 character
-					} else {
-						nextfont = curfont; //must use another font for this character, only draw up to here
-					}
-					break;
-				}
-			}
-
-			if (!charexists || nextfont) //the font we are using will not work
-				break; //stop scanning
-			else //go on scanning
-				charexists = 0;
+	s = shapetext(drw, text);
+	if (!render)
+		return s->w;
+
+	flushover(drw, x, y, w, h);
+	XSetForeground(drw->dpy, drw->gc, drw->scheme[invert ? ColFg : ColBg].pixel); //set foreground for GC
+	XFillRectangle(drw->dpy, drw->drawable, drw->gc, x, y, w, h); //fill rectangle around text
+	color = &drw->scheme[invert ? ColBg : ColFg];
+	end = x + w;
+	x += lpad;
+	w -= lpad;
+	x0 = x;
+
+	for (r = s->runs; r < s->runs + s->nruns; r++) { //draw each chunk of text
+		g = s->chars + r->first;
+		ew = g[r->n].x - g[0].x;
+		k = r->n;
+		if (ew > w) { //find the most characters that fit along with an ellipsis
+			if (r->font->ellipsisw > w)
+				break;
+			for (lo = 0, hi = r->n; hi - lo > 1; ) //those up to lo fit, those up to hi do not
+				if (g[(lo + hi) / 2].x - g[0].x + r->font->ellipsisw <= w)
+					lo = (lo + hi) / 2;
+				else
+					hi = (lo + hi) / 2;
+			k = lo;
 		}
 
-		if (utf8strlen) { //if the chunk of text actually exists
-			drw_font_getexts(usedfont, utf8str, utf8strlen, &ew, NULL); //get text width
-			/* shorten text if necessary */
-			for (len = MIN(utf8strlen, sizeof(buf) - 1); len && ew > w; len--) //shorten tet until it fits
-				drw_font_getexts(usedfont, utf8str, len, &ew, NULL);
-
-			if (len) {
-				memcpy(buf, utf8str, len);
-				buf[len] = '\0';
-				if (len < utf8strlen) //if we shortened it
-					for (i = len; i && i > len - 3; buf[--i] = '.') //add ellipsis at the end
-						; /* NOP */
-
-				if (render) {
-					ty = y + (h - usedfont->h) / 2 + usedfont->xfont->ascent; //center text vertically in given rectangle
-					XftDrawStringUtf8(d, &drw->scheme[invert ? ColBg : ColFg],
-					                  usedfont->xfont, x, ty, (XftChar8*)buf, len); //draw text
-				}
-				x += ew; //next chunk of text
-				w -= ew; //less space available
-			}
-		} //if chunk exists
-
-		if (!*text) { //reached NULL terminator
+		r->font->used = ++drw->fonttick;
+		ty = y + (h - r->font->h) / 2 + r->font->xfont->ascent; //center text vertically in given rectangle
+		for (i = 0; i < k; i++)
+			queueglyph(drw, color, r->font, g[i].glyph, x + g[i].x - g[0].x, ty);
+		if (k < r->n) { //it was cut
+			for (i = 0; i < 3; i++)
+				queueglyph(drw, color, r->font, r->font->dot, x + g[k].x - g[0].x + i * r->font->ellipsisw / 3, ty);
+			x += g[k].x - g[0].x + r->font->ellipsisw;
 			break;
-		} else if (nextfont) { //must change font for next chunk
-			charexists = 0;
-			usedfont = nextfont;
-		} else { //there is no font for next chunk
-			/* Regardless of whether or not a fallback font is found, the
-			 * character must be drawn. */
-			charexists = 1; //just use the usedfont that will be set later
-
-			fccharset = FcCharSetCreate();
-			FcCharSetAddChar(fccharset, utf8codepoint); //add the problematic character
-
-			if (!drw->fonts->pattern) {
-				/* Refer to the comment in xfont_create for more information. */
-				die("the first font in the cache must be loaded from a font string.");
-			}
+		}
+		x += ew; //next chunk of text
+		w -= ew; //less space available
+	}
 
-			fcpattern = FcPatternDuplicate(drw->fonts->pattern); //use the default font pattern
-			FcPatternAddCharSet(fcpattern, FC_CHARSET, fccharset); //but must contain the desired character
-			FcPatternAddBool(fcpattern, FC_SCALABLE, FcTrue); //also must be scalable
-
-			FcConfigSubstitute(NULL, fcpattern, FcMatchPattern); //substitute pattern using default configuration
-			FcDefaultSubstitute(fcpattern); //substitute default values for nonspecified font patterns
-			match = XftFontMatch(drw->dpy, drw->screen, fcpattern, &result); //get matching font
-
-			FcCharSetDestroy(fccharset);
-			FcPatternDestroy(fcpattern);
-
-			if (match) {
-				usedfont = xfont_create(drw, NULL, match); //make font that matches pattern
-				if (usedfont && XftCharExists(drw->dpy, usedfont->xfont, utf8codepoint)) {
-					for (curfont = drw->fonts; curfont->next; curfont = curfont->next) //find last font
-						; /* NOP */
-					curfont->next = usedfont; //add new font at the end
-				} else {
-					xfont_free(usedfont);
-					usedfont = drw->fonts; //use default font instead
-				}
-			}
+	if (x > x0) { //remember where glyphs are pending
+		if (drw->npending == drw->pendingsize) {
+			drw->pendingsize = MAX(16, 2 * drw->pendingsize);
+			pending = ecalloc(drw->pendingsize, sizeof(XRectangle));
+			if (drw->npending)
+				memcpy(pending, drw->pending, drw->npending * sizeof(XRectangle));
+			free(drw->pending);
+			drw->pending = pending;
 		}
+		drw->pending[drw->npending++] = (XRectangle) {x0, y, x - x0, h};
 	}
-	if (d) //cleanup
-		XftDrawDestroy(d);
 
-	return x + (render ? w : 0); //return text width, or specified width
+	return end; //return specified width
+}
+
+void drw_flush(Drw* drw) {
+	/*! \brief Draw the glyphs queued by drw_text() into the selected buffer.
+	 *
+	 * Glyphs are sent with one XftDrawGlyphFontSpec() call per color. This is
+	 * done by drw_map() and drw_setbuf(), so callers rarely need it.
+  **/
+
+	if (drw)
+		dropglyphs(drw, 1);
 }
 
 void drw_map(Drw* drw, Window win, int x, int y, unsigned int w, unsigned int h) {
@@ -423,8 +890,8 @@ void drw_map(Drw* drw, Window win, int x, int y, unsigned int w, unsigned int h)
 	if (!drw)
 		return;
 
-	XCopyArea(drw->dpy, drw->drawable, win, drw->gc, x, y, w, h, x, y);
-	XSync(drw->dpy, False);
+	drw_flush(drw); //the buffer must be complete
+	XCopyArea(drw->dpy, drw->drawable, win, drw->gc, x, y, w, h, x, y); //flushed along with other requests
 }
 
 unsigned int drw_fontset_getwidth(Drw* drw, const char* text) {
@@ -8,33 +8,123 @@ typedef struct {
 typedef struct Fnt {
 	Display *dpy;
 	unsigned int h; //!< Font height (ascent + descent)
+	unsigned int ellipsisw; //!< Width of "..." drawn with this font
+	FT_UInt dot; //!< Glyph of '.', for ellipses
 	XftFont *xfont;
 	FcPattern *pattern;
+	unsigned long used; //!< Drw::fonttick when last used, for LRU eviction of fallback fonts
+	unsigned int nglyphs; //!< Distinct characters resolved to this font, an upper bound on its cached glyphs
+	unsigned char *seen[17]; //!< Bitmap of the characters counted in #nglyphs for each Unicode plane, allocated when needed
 	struct Fnt *next;
 } Fnt;
 
+typedef struct {
+	size_t off; //!< Byte offset of the character in the text
+	unsigned int x; //!< Advance width of the text before it
+	FT_UInt glyph; //!< Glyph of the character in the font of its run
+} CharPos; //!< Position of a character in a text, see Shape::chars
+
+typedef struct {
+	Fnt *font; //!< Font the run is drawn with
+	size_t first, n; //!< Range of the run's characters in Shape::chars
+} Run; //!< Part of a text drawn with a single font
+
+#define SHAPECACHESIZE 64 //!< Number of texts whose runs are remembered
+
+typedef struct {
+	uint64_t hash; //!< Hash of #text, 0 for an unused entry
+	unsigned int gen; //!< Drw::fontgen when the text was shaped
+	unsigned long used; //!< Drw::shapetick when last used, for LRU replacement
+	char *text;
+	Run *runs;
+	size_t nruns;
+	size_t runsize; //!< Number of elements allocated for #runs
+	CharPos *chars; //!< Every character, then one more element for the end of the text
+	size_t nchars; //!< Number of characters in #chars
+	size_t charsize; //!< Number of elements allocated for #chars
+	unsigned int w; //!< Total advance width
+} Shape; //!< Cached segmentation of a text into runs, see drw_text()
+
+#define ASTRALSIZE 1024 //!< Number of slots in Drw::astral, a power of two
+
+typedef struct {
+	long codepoint;
+	unsigned char font; //!< Index in Drw::fontv plus one, 0 for an empty slot
+} CharSlot; //!< Font of a character outside the BMP, see Drw::astral
+
+#define MATCHSIZE 256 //!< Number of slots in Drw::matches, a power of two
+
+typedef struct {
+	long codepoint; //!< Character, 0 for an empty slot
+	FcPattern *match; //!< Fallback font fontconfig found for it, or NULL if there is none
+} MatchSlot; //!< Result of a fontconfig search, see Drw::matches
+
 enum { ColFg, ColBg, ColBorder }; //!< Clr scheme index
 typedef XftColor Clr;
 
+#define NBATCHES 4 //!< Number of colors whose glyphs can wait to be drawn at once
+
+typedef struct {
+	const Clr *color; //!< NULL for an unused batch
+	XftGlyphFontSpec *specs;
+	unsigned int n;
+	unsigned int size; //!< Number of elements allocated for #specs
+} Batch; //!< Glyphs waiting to be drawn in one color, see drw_flush()
+
 typedef struct {
 	unsigned int w, h;
+	Drawable drawable;
+	XftDraw *xftdraw; //!< Xft target for #drawable, created when first needed
+} Buf; //!< Offscreen buffer, see drw_setbuf()
+
+typedef struct {
+	unsigned int w, h; //!< Size of the selected buffer
 	Display *dpy;
 	int screen;
 	Window root;
-	Drawable drawable;
+	Drawable drawable; //!< Selected buffer, drawing functions draw here
 	GC gc;
 	Clr *scheme;
 	Fnt *fonts;
+	unsigned int fontgen; //!< Incremented whenever #fonts changes, invalidating #shapes
+	unsigned int npinned; //!< Number of fonts at the start of #fonts that are never evicted
+	unsigned int maxfallback; //!< Maximum number of fallback fonts after them, 0 for no limit
+	unsigned long fonttick; //!< Clock for Fnt::used
+	unsigned long keeptick; //!< Fonts used after this #fonttick are in use and not evicted
+	Buf own; //!< Buffer created by drw_create(), if any
+	Buf *buf; //!< Selected buffer, or NULL
+	Batch batches[NBATCHES]; //!< Glyphs drawn into #buf since the last drw_flush()
+	XRectangle *pending; //!< Areas covered by #batches
+	unsigned int npending; //!< Number of elements in #pending
+	unsigned int pendingsize; //!< Number of elements allocated for #pending
+	Shape shapes[SHAPECACHESIZE]; //!< Recently drawn or measured texts
+	Fnt **fontv; //!< #fonts as an array, indexed by #bmpfonts and #astral
+	unsigned int nfontv; //!< Number of elements in #fontv
+	unsigned int mapgen; //!< #fontgen when #bmpfonts and #astral were last cleared
+	unsigned char *bmpfonts; //!< Index in #fontv plus one of the font of each BMP character, 0 if not looked up yet
+	CharSlot astral[ASTRALSIZE]; //!< Linear probing hash table with the font of other characters
+	unsigned int nastral; //!< Number of used slots in #astral, kept at most half
+	unsigned long charhits, charmisses; //!< Performance counters for #bmpfonts and #astral
+	MatchSlot matches[MATCHSIZE]; //!< Linear probing hash table with fontconfig results for characters no font had
+	unsigned int nmatches; //!< Number of used slots in #matches, kept at most half
+	Fnt *matchbase; //!< First font of the fontset #matches were searched from
+	unsigned long matchhits, matchmisses; //!< Performance counters for #matches
+	unsigned long shapetick; //!< Clock for Shape::used
+	unsigned long shapehits, shapemisses; //!< Performance counters for #shapes
 } Drw;
 
 /* Drawable abstraction */
 Drw* drw_create(Display *dpy, int screen, Window root, unsigned int w, unsigned int h);
 void drw_resize(Drw *drw, unsigned int w, unsigned int h);
 void drw_free(Drw *drw);
+Buf* drw_buf_create(Drw *drw, unsigned int w, unsigned int h);
+void drw_buf_free(Drw *drw, Buf *buf);
+void drw_buf_resize(Drw *drw, Buf *buf, unsigned int w, unsigned int h);
 
 /* Fnt abstraction */
-Fnt* drw_fontset_create(Drw* drw, const char *fonts[], size_t fontcount);
+Fnt* drw_fontset_create(Drw* drw, const char *fonts[], size_t fontcount, unsigned int maxfallback);
 void drw_fontset_free(Fnt* set);
+void drw_fontset_getstats(Drw *drw, unsigned int *n, unsigned long *bytes);
 unsigned int drw_fontset_getwidth(Drw *drw, const char *text);
 void drw_font_getexts(Fnt *font, const char *text, unsigned int len, unsigned int *w, unsigned int *h);
 
@@ -47,6 +137,7 @@ Cur* drw_cur_create(Drw *drw, int shape);
 void drw_cur_free(Drw *drw, Cur *cursor);
 
 /* Drawing context manipulation */
+void drw_setbuf(Drw *drw, Buf *buf);
 void drw_setfontset(Drw *drw, Fnt *set);
 void drw_setscheme(Drw *drw, Clr *scm);
 
@@ -55,4 +146,5 @@ void drw_rect(Drw *drw, int x, int y, unsigned int w, unsigned int h, int filled
 int drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lpad, const char *text, int invert);
 
 /* Map functions */
+void drw_flush(Drw *drw);
 void drw_map(Drw *drw, Window win, int x, int y, unsigned int w, unsigned int h);
@@ -2,14 +2,16 @@
  * See LICENSE file for copyright and license details.
  *
  * dynamic window manager is designed like any other X client as well. It is
- * driven through handling X events. In contrast to other X clients, a window
+ * driven through handling X events, which are waited for along with signals
+ * and timers in a single epoll(7) loop. In contrast to other X clients, a window
  * manager selects for SubstructureRedirectMask on the root window, to receive
  * events about window (dis-)appearance. Only one X connection at a time is
  * allowed to select for this event mask.
  *
  * The event handlers of dwm are organized in an array which is accessed
  * whenever a new event has been fetched. This allows event dispatching
- * in O(1) time.
+ * in O(1) time. Events are fetched in batches, and redundant events in a
+ * batch are coalesced before being dispatched (see xevents()).
  *
  * Each child of the root window is called a client, except windows which have
  * set the override_redirect flag. Clients are organized in a linked client
@@ -25,16 +27,22 @@
 #include <locale.h>
 #include <signal.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <X11/cursorfont.h>
 #include <X11/keysym.h>
 #include <X11/Xatom.h>
 #include <X11/Xlib.h>
+#include <X11/Xlib-xcb.h>
 #include <X11/Xproto.h>
 #include <X11/Xutil.h>
 #ifdef XINERAMA
@@ -53,20 +61,26 @@
 #define ISVISIBLE(C)            ((C->tags & C->mon->tagset[C->mon->seltags])) // Whether a particular client's window is visible
 #define LENGTH(X)               (sizeof X / sizeof X[0]) // Number of elements in a static array
 #define MOUSEMASK               (BUTTONMASK|PointerMotionMask)
+#define SLABSIZE                64 // Number of clients allocated at once, see newclient()
 #define WIDTH(X)                ((X)->w + 2 * (X)->bw) // Width of a particular window, including border
 #define HEIGHT(X)               ((X)->h + 2 * (X)->bw) // Height of a particular window, including border
 #define TAGMASK                 ((1 << LENGTH(tags)) - 1) // Bitmask representing all available tags
 #define TEXTW(X)                (drw_fontset_getwidth(drw, (X)) + lrpad) // Text width (including padding)
+#define WINHASH(W)              ((unsigned int)(((W) * 0x9E3779B97F4A7C15ull) >> 32) & (wintabsize - 1)) // Preferred slot of a window in #wintab
 
 /* enums */
 enum { CurNormal, CurResize, CurMove, CurLast }; //!< cursor
 enum { SchemeNorm, SchemeSel }; //!< color schemes
+enum { BarStatus, BarTags, BarLayout, BarTitle, BarLast }; //!< bar segments, see drawbar()
+enum { DirtyLayout = 1 << 0, DirtyStack = 1 << 1, DirtyBar = 1 << 2 }; //!< monitor update flags, see commit()
 enum { NetSupported, NetWMName, NetWMState, NetWMCheck,
        NetWMFullscreen, NetActiveWindow, NetWMWindowType,
-       NetWMWindowTypeDialog, NetClientList, NetLast }; //!< EWMH atoms
+       NetWMWindowTypeDialog, NetClientList, NetClientListStacking, NetLast }; //!< EWMH atoms
 enum { WMProtocols, WMDelete, WMState, WMTakeFocus, WMLast }; //!< default atoms
 enum { ClkTagBar, ClkLtSymbol, ClkStatusText, ClkWinTitle,
        ClkClientWin, ClkRootWin, ClkLast }; //!< clicks
+enum { PropNetWMName, PropWMName, PropTransient, PropClass, PropState,
+       PropWindowType, PropNormalHints, PropHints, PropLast }; //!< properties fetched by manage()
 
 typedef union {
 	int i;
@@ -84,10 +98,8 @@ typedef struct {
 } Button; //!< A mouse button shorcut
 
 typedef struct Monitor Monitor;
-typedef struct Client Client;
-struct Client {
-	char name[256];
-	int x, y, w, h;
+typedef struct {
+	char* name; //!< Window title, never NULL once managed
 	int oldx, oldy, oldw, oldh;
   /** @name Size hints
    * Window size hints. See applysizehints().
@@ -96,16 +108,36 @@ struct Client {
 	int basew, baseh, incw, inch, maxw, maxh, minw, minh;
   float mina, maxa;
   /**@}*/
-	int bw; //!< Border width
   int oldbw; //!< Saved border width
-	unsigned int tags;
-	int isfixed; //!< Client window size is fixed due to its size hints
-  int isfloating, isurgent, neverfocus, oldstate, isfullscreen;
+} ClientInfo; //!< Client data not needed to arrange or show clients, see Client::info
+
+typedef struct Client Client;
+struct Client {
 	Client* next; //!< Next client in list
+	Client* prev; //!< Previous client in list
 	Client* snext; //!< Next client in stack
+	Client* sprev; //!< Previous client in stack
 	Monitor* mon;
+	unsigned int tags;
+	int x, y, w, h;
+	int bw; //!< Border width
+	int cx, cy, cw, ch, cbw; //!< Geometry last sent to the X server, see sendgeom()
+	unsigned int stackpos; //!< Index in Monitor::stacked, if still valid, see restack()
+	unsigned char isfixed; //!< Client window size is fixed due to its size hints
+  unsigned char isfloating, isurgent, neverfocus, oldstate, isfullscreen;
+	unsigned char ishidden; //!< Window is out of the screen, see showhide()
+	unsigned char ispending; //!< Geometry must be sent by commit(), see queuegeom()
+	unsigned char isrequested; //!< The client asked for its pending geometry and must be notified even if unchanged, see sendgeom()
 	Window win;
-};
+	ClientInfo* info; //!< Less frequently used data
+}; //!< A managed window, allocated from #slabs by newclient()
+
+typedef struct Slab Slab;
+struct Slab {
+	Client clients[SLABSIZE];
+	ClientInfo infos[SLABSIZE];
+	Slab* next;
+}; //!< A block of clients, see newclient()
 
 typedef struct {
 	unsigned int mod;
@@ -116,7 +148,7 @@ typedef struct {
 
 typedef struct {
 	const char* symbol;
-	void (*arrange)(Monitor*);
+	void (*arrange)(Monitor* m, Client** tiled, unsigned int n); //!< Arrange the n visible tiled clients of a monitor
 } Layout;
 
 struct Monitor {
@@ -139,11 +171,29 @@ struct Monitor {
   const Layout* lt[2]; //!< Two saved layouts
 	int showbar; //!< show/hide bar
 	int topbar; //!< bar at the top/bottom
+	unsigned int dirty; //!< Parts of the monitor that need to be updated, see commit()
+	unsigned int occ; //!< Tags with at least one client, see countclient()
+	unsigned int urg; //!< Tags with at least one urgent client
+	unsigned int ntagged[32]; //!< Number of clients with each tag
+	unsigned int nurgent[32]; //!< Number of urgent clients with each tag
+	Client** tiled; //!< Visible tiled clients, in list order, see updatetiled()
+	unsigned int ntiled; //!< Number of elements in #tiled
+	unsigned int nvisible; //!< Number of visible clients, tiled or not
+	unsigned int tiledsize; //!< Number of elements allocated for #tiled
+	int tiledvalid; //!< Whether #tiled, #ntiled and #nvisible are up to date
+	uint64_t sig; //!< Inputs of the layout when it was last run, see layoutsig()
+	uint64_t barkeys[BarLast]; //!< Inputs of each bar segment when it was last drawn, 0 to redraw it
+	Window* stacked; //!< Bar and tiled windows, top to bottom, as last restacked
+	unsigned int nstacked; //!< Number of elements in #stacked
+	Window raised; //!< Window last raised by restack(), or None if another one may be above it
 	Client* clients; //!< List of clients
+	Client* last; //!< Last client in #clients
 	Client* sel; //!< Selected client
 	Client* stack; //!< Client stack
+	Client* stail; //!< Last client in #stack, the bottom one
 	Monitor* next;
 	Window barwin;
+	Buf* barbuf; //!< Offscreen image of the bar, #ww by #bh, see drawbar()
 };
 
 typedef struct {
@@ -161,21 +211,55 @@ typedef struct {
 	int monitor;
 } Rule; //!< A rule for creating windows
 
+typedef xcb_get_property_reply_t Prop; //!< A window property, see getprops()
+
+typedef struct {
+	int fd;
+	void (*func)(int fd); //!< Called when fd is readable, or NULL
+} Watch; //!< A file descriptor watched by the main loop, see run()
+
+typedef struct {
+	unsigned long calls; //!< Number of times it was run
+	unsigned long requests; //!< Number of X requests it issued
+	unsigned long syncs; //!< Number of round trips it made, see #nsyncs
+} Stat; //!< Performance counters for an event handler or commit(), see printstats()
+
+typedef struct {
+	unsigned long arranges; //!< Number of monitor layouts updated by commit()
+	unsigned long configures; //!< Geometry changes sent for them
+	unsigned long unchanged; //!< Geometries found unchanged for them, and not sent
+} GeomStat; //!< Performance counters for the geometry changes of arranged layouts, see printstats()
+
+typedef struct {
+	Window win; //!< Key, None if the slot is free
+	Client* c; //!< Client of the window, or NULL
+	Monitor* m; //!< Monitor whose bar is the window, or NULL
+} WinSlot; //!< An entry in #wintab, see findwin()
+
 /* function declarations */
-static void applyrules(Client* c);
+static void applyrules(Client* c, Prop* res);
 static int applysizehints(Client* c, int* x, int* y, int* w, int* h, int interact);
+static int addtimer(unsigned int ms, void (*func)(int fd));
+static void addwatch(int fd, void (*func)(int fd));
 static void arrange(Monitor* m);
 static void arrangemon(Monitor* m);
 static void attach(Client* c);
 static void attachstack(Client* c);
+static int barkey(Monitor* m, int seg, const int* k, size_t n, const char* text);
 static void buttonpress(XEvent* e);
+#ifdef DEBUG
+static void checkcounts(void);
+#endif /* DEBUG */
 static void checkotherwm(void);
 static void cleanup(void);
 static void cleanupmon(Monitor* mon);
 static void clientmessage(XEvent* e);
+static void clientprops(Window w, Window* pw, Atom* pa);
+static void commit(void);
 static void configure(Client* c);
 static void configurenotify(XEvent* e);
 static void configurerequest(XEvent* e);
+static void countclient(Client* c, int n);
 static Monitor* createmon(void);
 static void destroynotify(XEvent* e);
 static void detach(Client* c);
@@ -184,29 +268,43 @@ static Monitor* dirtomon(int dir);
 static void drawbar(Monitor* m);
 static void drawbars(void);
 static void enternotify(XEvent* e);
+static Window eventwin(XEvent* e);
 static void expose(XEvent* e);
+static WinSlot* findwin(Window w);
+static void flushgeom(Monitor* m);
 static void focus(Client* c);
+static void freeclient(Client* c);
 static void focusin(XEvent* e);
 static void focusmon(const Arg* arg);
 static void focusstack(const Arg* arg);
+static void getprops(const Window* w, const Atom* a, unsigned int n, Prop** r);
 static int getrootptr(int* x, int* y);
-static long getstate(Window w);
 static int gettextprop(Window w, Atom atom, char* text, unsigned int size);
 static void grabbuttons(Client* c, int focused);
 static void grabkeys(void);
+static uint64_t hashbytes(uint64_t h, const void* p, size_t n);
+static void hashwin(Window w, Client* c, Monitor* m);
 static void incnmaster(const Arg* arg);
 static void keypress(XEvent* e);
 static void killclient(const Arg* arg);
-static void manage(Window w, XWindowAttributes* wa);
+static uint64_t layoutsig(Monitor* m);
+static void manage(Window w, XWindowAttributes* wa, Prop** props);
 static void mappingnotify(XEvent* e);
 static void maprequest(XEvent* e);
-static void monocle(Monitor* m);
+static void monocle(Monitor* m, Client** tiled, unsigned int n);
+static Client* newclient(void);
 static void motionnotify(XEvent* e);
 static void movemouse(const Arg* arg);
 static Client* nexttiled(Client* c);
 static void pop(Client*);
+static void printstats(void);
+static void* propdata(Prop* r, Atom type, int format, unsigned int n);
 static void propertynotify(XEvent* e);
+static char* proptext(Prop* r);
+static void queueevent(XEvent* e);
+static void queuegeom(Client* c);
 static void quit(const Arg* arg);
+static void raiseclient(Client* c);
 static Monitor* recttomon(int x, int y, int w, int h);
 static void resize(Client* c, int x, int y, int w, int h, int interact);
 static void resizeclient(Client* c, int x, int y, int w, int h);
@@ -215,25 +313,35 @@ static void restack(Monitor* m);
 static void run(void);
 static void scan(void);
 static int sendevent(Client* c, Atom proto);
+static void sendgeom(Client* c);
 static void sendmon(Client* c, Monitor* m);
 static void setclientstate(Client* c, long state);
 static void setfocus(Client* c);
+static void setfloating(Client* c, int floating);
 static void setfullscreen(Client* c, int fullscreen);
 static void setlayout(const Arg* arg);
 static void setmfact(const Arg* arg);
+static void setsizehints(Client* c, Prop* r);
+static void settags(Client* c, unsigned int tags);
+static void settitle(Client* c, Prop* netname, Prop* name);
 static void setup(void);
 static void seturgent(Client* c, int urg);
+static void setwindowtype(Client* c, Prop* state, Prop* wtype);
+static void setwmhints(Client* c, Prop* r);
 static void showhide(Client* c);
-static void sigchld(int unused);
+static void signals(int fd);
+static void skipenters(void);
 static void spawn(const Arg* arg);
+static void statstimer(int fd);
 static void tag(const Arg* arg);
 static void tagmon(const Arg* arg);
-static void tile(Monitor* m);
+static void tile(Monitor* m, Client** tiled, unsigned int n);
 static void togglebar(const Arg* arg);
 static void togglefloating(const Arg* arg);
 static void toggletag(const Arg* arg);
 static void toggleview(const Arg* arg);
 static void unfocus(Client* c, int setfocus);
+static void unhashwin(Window w);
 static void unmanage(Client* c, int destroyed);
 static void unmapnotify(XEvent* e);
 static void updatebarpos(Monitor* m);
@@ -242,7 +350,9 @@ static void updateclientlist(void);
 static int updategeom(void);
 static void updatenumlockmask(void);
 static void updatesizehints(Client* c);
+static void updatestacking(void);
 static void updatestatus(void);
+static void updatetiled(Monitor* m);
 static void updatetitle(Client* c);
 static void updatewindowtype(Client* c);
 static void updatewmhints(Client* c);
@@ -250,8 +360,10 @@ static void view(const Arg* arg);
 static Client* wintoclient(Window w);
 static Monitor* wintomon(Window w);
 static int xerror(Display* dpy, XErrorEvent* ee);
+static void xevents(void);
 static int xerrordummy(Display* dpy, XErrorEvent* ee);
 static int xerrorstart(Display* dpy, XErrorEvent* ee);
+static void xsync(void);
 static void zoom(const Arg* arg);
 
 /* variables */
@@ -283,11 +395,53 @@ static void (*handler[LASTEvent]) (XEvent*) = {
 	[PropertyNotify] = propertynotify,
 	[UnmapNotify] = unmapnotify
 }; //!< List of event handlers
+static XEvent evq[256]; //!< Batch of events being dispatched, see xevents()
+static unsigned int evqlen = 0; //!< Number of events in #evq
+static unsigned int evqpos = 0; //!< Index of the event being dispatched in #evq
+static const char* evname[LASTEvent] = {
+	[ButtonPress] = "ButtonPress",
+	[ClientMessage] = "ClientMessage",
+	[ConfigureRequest] = "ConfigureRequest",
+	[ConfigureNotify] = "ConfigureNotify",
+	[DestroyNotify] = "DestroyNotify",
+	[EnterNotify] = "EnterNotify",
+	[Expose] = "Expose",
+	[FocusIn] = "FocusIn",
+	[KeyPress] = "KeyPress",
+	[MappingNotify] = "MappingNotify",
+	[MapRequest] = "MapRequest",
+	[MotionNotify] = "MotionNotify",
+	[PropertyNotify] = "PropertyNotify",
+	[UnmapNotify] = "UnmapNotify"
+}; //!< Names of handled events, see printstats()
+static Stat evstats[LASTEvent]; //!< Performance counters for each event handler
+static Stat commitstats; //!< Performance counters for commit()
+static Stat barstats; //!< Performance counters for drawbar(), when something is drawn
+static unsigned long nsyncs = 0; //!< Number of round trips to the X server: calls to xsync() and requests waited on for a reply
+static WinSlot* wintab = NULL; //!< Open addressing hash table of client and bar windows, see findwin()
+static unsigned int wintabsize = 0; //!< Number of slots in #wintab, a power of two
+static unsigned int wintablen = 0; //!< Number of used slots in #wintab
+static unsigned long nlookups = 0, nprobes = 0; //!< Number of calls to findwin() and of slots they examined
+static Slab* slabs = NULL; //!< All memory blocks for clients, see newclient()
+static Client* freeclients = NULL; //!< Unused clients in #slabs, linked through Client::next
+static Watch watches[8]; //!< File descriptors watched by the main loop
+static unsigned int nwatches = 0; //!< Number of elements in #watches
+static int epfd = -1; //!< epoll(7) instance of the main loop
+static sigset_t sigmask; //!< Signals received through #watches instead of handlers
 static Atom wmatom[WMLast], netatom[NetLast];
 static int running = 1; //!< If set to 0, terminate
+static unsigned int npending = 0; //!< Number of clients with Client::ispending set
+static unsigned long nconfigures = 0, nunchanged = 0; //!< Number of geometry changes sent, and of those found unchanged
+static GeomStat arrangestats; //!< #nconfigures and #nunchanged counted within arranges, see commit()
+static unsigned long geomgen = 0; //!< Incremented whenever client geometry may change outside of layouts
+static unsigned long nsighits = 0, nsigmisses = 0; //!< Number of layouts skipped and run by arrangemon()
+static int arranging = 0; //!< Set while a layout runs
+static int stackchanged = 0; //!< If set, commit() updates _NET_CLIENT_LIST_STACKING
+static int adopting = 0; //!< If set, manage() leaves arranging, focusing and the client list to its caller
 static Cur* cursor[CurLast];
 static Clr** scheme; //!< Loaded color scheme
 static Display* dpy;
+static xcb_connection_t* xcon; //!< XCB connection underlying #dpy, for asynchronous requests
 static Drw* drw;
 static Monitor* mons; //!< Linked list of all distinct monitors
 static Monitor* selmon; //!< Currently selected monitor
@@ -301,26 +455,74 @@ static Window wmcheckwin; //!< Dummy window to identify as a compliant WM
 struct NumTags { char limitexceeded[LENGTH(tags) > 31 ? -1 : 1]; };
 
 /* function implementations */
-void applyrules(Client* c) {
+int addtimer(unsigned int ms, void (*func)(int fd)) {
+  /*! \brief Create a periodic timer and watch it from the main loop.
+   * \param ms [in] Period of the timer, in milliseconds.
+   * \param func [in] Called on expiration. It must read(2) the expiration count from its fd.
+   * \return The timerfd(2) descriptor of the timer.
+  **/
+
+	int fd;
+	struct itimerspec its;
+
+	if ((fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC)) < 0)
+		die("timerfd_create:");
+	its.it_interval.tv_sec = its.it_value.tv_sec = ms / 1000;
+	its.it_interval.tv_nsec = its.it_value.tv_nsec = ms % 1000 * 1000000;
+	if (timerfd_settime(fd, 0, &its, NULL) < 0)
+		die("timerfd_settime:");
+	addwatch(fd, func);
+	return fd;
+}
+
+void addwatch(int fd, void (*func)(int fd)) {
+  /*! \brief Make the main loop wait for a file descriptor to become readable.
+   *
+   * This is the place to plug in timers, sockets and any other event source
+   * without threads or polling.
+   *
+   * \sa run()
+  **/
+
+	struct epoll_event ev;
+
+	if (nwatches >= LENGTH(watches))
+		die("too many watched file descriptors");
+	watches[nwatches].fd = fd;
+	watches[nwatches].func = func;
+	ev.events = EPOLLIN;
+	ev.data.ptr = &watches[nwatches++];
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+		die("epoll_ctl:");
+}
+
+void applyrules(Client* c, Prop* res) {
   /*! \brief Apply rules defined in #rules to a newly created client, or default properties.
+   * \param c [in, out] The new client.
+   * \param res [in] The WM_CLASS property of its window.
   **/
 
 	const char* class, *instance;
+	char* v, name[2][256] = { "", "" };
 	unsigned int i;
 	const Rule* r;
 	Monitor* m;
-	XClassHint ch = { NULL, NULL };
 
 	/* rule matching */
 	c->isfloating = 0;
 	c->tags = 0;
-	XGetClassHint(dpy, c->win, &ch); //get name and class
-	class    = ch.res_class ? ch.res_class : broken;
-	instance = ch.res_name  ? ch.res_name  : broken;
+	if ((v = propdata(res, XA_STRING, 8, 1))) { //get name and class, both null-terminated
+		i = strnlen(v, res->value_len);
+		snprintf(name[0], sizeof name[0], "%.*s", (int)i, v);
+		if (i < res->value_len)
+			snprintf(name[1], sizeof name[1], "%.*s", (int)(res->value_len - i - 1), v + i + 1);
+	}
+	class    = name[1][0] ? name[1] : broken;
+	instance = name[0][0] ? name[0] : broken;
 
 	for (i = 0; i < LENGTH(rules); i++) {
 		r = &rules[i];
-		if ((!r->title || strstr(c->name, r->title)) //title must match (title rule must be included in client title)
+		if ((!r->title || strstr(c->info->name, r->title)) //title must match (title rule must be included in client title)
 		&& (!r->class || strstr(class, r->class)) //class must match (class rule must be included in client class)
 		&& (!r->instance || strstr(instance, r->instance))) //name must match (name rule must be included in client name)
 		{
@@ -331,10 +533,6 @@ void applyrules(Client* c) {
 				c->mon = m; //put in monitor matching monitor number, if there is a match
 		}
 	}
-	if (ch.res_class)
-		XFree(ch.res_class);
-	if (ch.res_name)
-		XFree(ch.res_name);
 	c->tags = c->tags & TAGMASK ? c->tags & TAGMASK : c->mon->tagset[c->mon->seltags]; //remove invalid tags; if no tag is set, set all selected tags
 }
 
@@ -405,69 +603,83 @@ int applysizehints(Client* c, int* x, int* y, int* w, int* h, int interact) {
      * minh <= *h <= maxh
      * mina <= (*w - basew) / (*h - baseh) <= maxa (see the sentences above)
     **/
-		baseismin = c->basew == c->minw && c->baseh == c->minh;
+		baseismin = c->info->basew == c->info->minw && c->info->baseh == c->info->minh;
 		if (!baseismin) { /* temporarily remove base dimensions */
-			*w -= c->basew;
-			*h -= c->baseh;
+			*w -= c->info->basew;
+			*h -= c->info->baseh;
 		}
 		/* adjust for aspect limits */
-		if (c->mina > 0 && c->maxa > 0) {
-			if (c->maxa < (float)*w / *h) //too long
-				*w = *h * c->maxa + 0.5; //shrink it, rounding up
-			else if (c->mina < (float)*h / *w) //too tall
-				*h = *w * c->mina + 0.5; //shrink it, rounding up
+		if (c->info->mina > 0 && c->info->maxa > 0) {
+			if (c->info->maxa < (float)*w / *h) //too long
+				*w = *h * c->info->maxa + 0.5; //shrink it, rounding up
+			else if (c->info->mina < (float)*h / *w) //too tall
+				*h = *w * c->info->mina + 0.5; //shrink it, rounding up
 		}
 		if (baseismin) { /* increment calculation requires this */
-			*w -= c->basew;
-			*h -= c->baseh;
+			*w -= c->info->basew;
+			*h -= c->info->baseh;
 		}
 		/* adjust for increment value */
-		if (c->incw)
-			*w -= *w % c->incw; //round down to a multiple of incw
-		if (c->inch)
-			*h -= *h % c->inch; //round down to a multiple of inch
+		if (c->info->incw)
+			*w -= *w % c->info->incw; //round down to a multiple of incw
+		if (c->info->inch)
+			*h -= *h % c->info->inch; //round down to a multiple of inch
 		/* restore base dimensions */
-		*w = MAX(*w + c->basew, c->minw); //also add basew and apply minw
-		*h = MAX(*h + c->baseh, c->minh); //also add baseh and apply minh
-		if (c->maxw)
-			*w = MIN(*w, c->maxw); //apply maxw
-		if (c->maxh)
-			*h = MIN(*h, c->maxh); //apply maxh
+		*w = MAX(*w + c->info->basew, c->info->minw); //also add basew and apply minw
+		*h = MAX(*h + c->info->baseh, c->info->minh); //also add baseh and apply minh
+		if (c->info->maxw)
+			*w = MIN(*w, c->info->maxw); //apply maxw
+		if (c->info->maxh)
+			*h = MIN(*h, c->info->maxh); //apply maxh
 	}
 	return *x != c->x || *y != c->y || *w != c->w || *h != c->h;
 }
 
 void arrange(Monitor* m) {
-  /*! \brief Update a monitor's layout.
+  /*! \brief Schedule an update of a monitor's layout.
    *
    * This will update visibility of all windows in a monitor, arrange its layout
    * and update the X window stack. If NULL is passed, all monitors are arranged
    * but their X stack is not updated and their windows not redrawn.
    *
+   * The work itself is deferred to the next commit(), so that calling this
+   * several times while handling a batch of events is cheap.
+   *
    * \sa arrangemon()
   **/
 
 	if (m)
-		showhide(m->stack);
+		m->dirty |= DirtyLayout|DirtyStack|DirtyBar;
 	else for (m = mons; m; m = m->next) //all monitors
-		showhide(m->stack);
-	if (m) {
-		arrangemon(m);
-		restack(m);
-	} else for (m = mons; m; m = m->next)
-		arrangemon(m);
+		m->dirty |= DirtyLayout;
 }
 
 void arrangemon(Monitor* m) {
   /*! \brief Update monitor layout symbol to that of the currently selected
    * layout and call arrange callback for that layout.
    *
+   * Nothing is done if the inputs of the layout did not change since it was
+   * last run, see layoutsig().
+   *
    * \sa arrange(), layouts
   **/
 
+	uint64_t sig;
+
+	if (!m->tiledvalid)
+		updatetiled(m);
+	if ((sig = layoutsig(m)) == m->sig) { //it would do exactly the same as last time
+		nsighits++;
+		return;
+	}
+	m->sig = sig;
+	nsigmisses++;
 	strncpy(m->ltsymbol, m->lt[m->sellt]->symbol, sizeof m->ltsymbol);
-	if (m->lt[m->sellt]->arrange)
-		m->lt[m->sellt]->arrange(m);
+	if (m->lt[m->sellt]->arrange) {
+		arranging = 1;
+		m->lt[m->sellt]->arrange(m, m->tiled, m->ntiled);
+		arranging = 0;
+	}
 }
 
 void attach(Client* c) {
@@ -475,8 +687,17 @@ void attach(Client* c) {
    * \sa detach(), attachstack()
   **/
 
+	c->prev = NULL;
 	c->next = c->mon->clients;
+	if (c->next)
+		c->next->prev = c;
+	else
+		c->mon->last = c;
 	c->mon->clients = c;
+	hashwin(c->win, c, NULL);
+	countclient(c, 1);
+	c->mon->tiledvalid = 0;
+	stackchanged = 1;
 }
 
 void attachstack(Client* c) {
@@ -484,10 +705,34 @@ void attachstack(Client* c) {
    * \sa detachstack(), attach()
   **/
 
+	c->sprev = NULL;
 	c->snext = c->mon->stack;
+	if (c->snext)
+		c->snext->sprev = c;
+	else
+		c->mon->stail = c;
 	c->mon->stack = c;
 }
 
+int barkey(Monitor* m, int seg, const int* k, size_t n, const char* text) {
+  /*! \brief Check whether a bar segment must be drawn, and remember its new inputs.
+   * \param seg [in] The segment, one of Bar*.
+   * \param k [in] Position, size and state the segment depends on.
+   * \param n [in] Number of elements in k.
+   * \param text [in] Text shown in the segment, or NULL.
+   * \return Whether its inputs changed since it was last drawn.
+  **/
+
+	uint64_t key = hashbytes(0, k, n * sizeof(int));
+
+	if (text)
+		key = hashbytes(key, text, strlen(text));
+	if (key == m->barkeys[seg])
+		return 0;
+	m->barkeys[seg] = key;
+	return 1;
+}
+
 void buttonpress(XEvent* e) {
   /*! \brief Handler for ButtonPress events.
    * \sa handler
@@ -524,7 +769,7 @@ void buttonpress(XEvent* e) {
 			click = ClkWinTitle;
 	} else if ((c = wintoclient(ev->window))) { //clicked on a client window
 		focus(c);
-		restack(selmon);
+		selmon->dirty |= DirtyStack;
 		XAllowEvents(dpy, ReplayPointer, CurrentTime); //pass the click event to the client
 		click = ClkClientWin;
 	}
@@ -534,6 +779,33 @@ void buttonpress(XEvent* e) {
 			buttons[i].func(click == ClkTagBar && buttons[i].arg.i == 0 ? &arg : &buttons[i].arg); //pass defined arg, or default one for ClkTagBar if none defined
 }
 
+#ifdef DEBUG
+void checkcounts(void) {
+  /*! \brief Check that the tag and urgency counts of every monitor match its clients.
+   *
+   * Only built with -DDEBUG, in which case it is run by commit().
+   *
+   * \sa countclient()
+  **/
+
+	unsigned int i, n, u;
+	Client* c;
+	Monitor* m;
+
+	for (m = mons; m; m = m->next)
+		for (i = 0; i < LENGTH(tags); i++) {
+			for (n = u = 0, c = m->clients; c; c = c->next)
+				if (c->tags & 1 << i) {
+					n++;
+					u += c->isurgent != 0;
+				}
+			if (n != m->ntagged[i] || u != m->nurgent[i]
+			|| !(m->occ & 1 << i) != !n || !(m->urg & 1 << i) != !u)
+				die("dwm: inconsistent counts for tag %u of monitor %d", i, m->num);
+		}
+}
+#endif /* DEBUG */
+
 void checkotherwm(void) {
   /*! \brief Check if another WM is running.
    *
@@ -542,9 +814,9 @@ void checkotherwm(void) {
 
 	xerrorxlib = XSetErrorHandler(xerrorstart);
 	XSelectInput(dpy, DefaultRootWindow(dpy), SubstructureRedirectMask); //this causes an error if some other window manager is running
-	XSync(dpy, False); //flush X server, call error handlers
+	xsync(); //flush X server, call error handlers
 	XSetErrorHandler(xerror);
-	XSync(dpy, False); //flush X server, call error handlers
+	xsync(); //flush X server, call error handlers
 }
 
 void cleanup(void) {
@@ -554,9 +826,11 @@ void cleanup(void) {
 	Arg a = {.ui = ~0};
 	Layout foo = { "", NULL };
 	Monitor* m;
+	Slab* s;
 	size_t i;
 
 	view(&a); //set all tags
+	commit(); //show all windows
 	selmon->lt[selmon->sellt] = &foo;
 	for (m = mons; m; m = m->next) //for all monitors
 		while (m->stack) //while there are clients in the stack
@@ -570,7 +844,16 @@ void cleanup(void) {
 		free(scheme[i]); //same length as static color scheme array
 	XDestroyWindow(dpy, wmcheckwin); //destroy dummy window
 	drw_free(drw);
-	XSync(dpy, False);
+	for (i = 0; i < nwatches; i++)
+		if (watches[i].fd != ConnectionNumber(dpy)) //closed by XCloseDisplay()
+			close(watches[i].fd);
+	close(epfd);
+	free(wintab);
+	while ((s = slabs)) {
+		slabs = s->next;
+		free(s);
+	}
+	xsync();
 	XSetInputFocus(dpy, PointerRoot, RevertToPointerRoot, CurrentTime); //give focus to the root window
 	XDeleteProperty(dpy, root, netatom[NetActiveWindow]);
 }
@@ -587,8 +870,12 @@ void cleanupmon(Monitor* mon) {
 		for (m = mons; m && m->next != mon; m = m->next); //find previous monitor
 		m->next = mon->next;
 	}
+	unhashwin(mon->barwin);
 	XUnmapWindow(dpy, mon->barwin);
 	XDestroyWindow(dpy, mon->barwin);
+	drw_buf_free(drw, mon->barbuf);
+	free(mon->stacked);
+	free(mon->tiled);
 	free(mon);
 }
 
@@ -613,6 +900,87 @@ void clientmessage(XEvent* e) {
 	}
 }
 
+void clientprops(Window w, Window* pw, Atom* pa) {
+  /*! \brief Fill in the requests for all properties needed by manage().
+   * \param w [in] Window to get properties from
+   * \param pw [out] Array of PropLast windows to pass to getprops()
+   * \param pa [out] Array of PropLast atoms to pass to getprops()
+  **/
+
+	int i;
+
+	pa[PropNetWMName] = netatom[NetWMName];
+	pa[PropWMName] = XA_WM_NAME;
+	pa[PropTransient] = XA_WM_TRANSIENT_FOR;
+	pa[PropClass] = XA_WM_CLASS;
+	pa[PropState] = netatom[NetWMState];
+	pa[PropWindowType] = netatom[NetWMWindowType];
+	pa[PropNormalHints] = XA_WM_NORMAL_HINTS;
+	pa[PropHints] = XA_WM_HINTS;
+	for (i = 0; i < PropLast; i++)
+		pw[i] = w;
+}
+
+void commit(void) {
+  /*! \brief Apply all updates scheduled through Monitor::dirty.
+   *
+   * For each monitor, this arranges its layout, restacks its windows and draws
+   * its bar, each at most once, in that order. It is called after every batch
+   * of events.
+   *
+   * All requests are buffered and flushed at the end. The only round trip
+   * happens after restacking, to discard the EnterNotify events generated by
+   * the old layout, and only if some window was actually restacked or moved.
+   *
+   * \sa arrange(), xevents()
+  **/
+
+	Monitor* m;
+	unsigned int dirty, restacked = 0;
+	unsigned long requests = XNextRequest(dpy), syncs = nsyncs, configures, unchanged;
+	unsigned long sent = nconfigures; //to know whether any window moved
+
+	for (m = mons; m; m = m->next) {
+		dirty = m->dirty;
+		m->dirty = 0;
+		configures = nconfigures;
+		unchanged = nunchanged;
+		if (dirty & DirtyLayout) {
+			showhide(m->stack);
+			arrangemon(m);
+		}
+		if (npending)
+			flushgeom(m);
+		if (dirty & DirtyLayout) {
+			arrangestats.arranges++;
+			arrangestats.configures += nconfigures - configures;
+			arrangestats.unchanged += nunchanged - unchanged;
+		}
+		if (dirty & DirtyStack) {
+			restack(m); //also draws the bar
+			restacked = 1;
+		} else if (dirty & DirtyBar)
+			drawbar(m);
+	}
+	if (restacked && !stackchanged && nconfigures == sent) //nothing moved, no EnterNotify to discard
+		restacked = 0;
+	if (stackchanged) {
+		updatestacking();
+		stackchanged = 0;
+	}
+	if (restacked) {
+		xsync();
+		skipenters(); //they were created in an outdated layout
+	} else
+		XFlush(dpy);
+	commitstats.calls++;
+	commitstats.requests += XNextRequest(dpy) - requests;
+	commitstats.syncs += nsyncs - syncs;
+#ifdef DEBUG
+	checkcounts();
+#endif /* DEBUG */
+}
+
 void configure(Client* c) {
   /*! \brief Notify client of changes to its window geometry.
   **/
@@ -649,7 +1017,6 @@ void configurenotify(XEvent* e) {
 		sw = ev->width;
 		sh = ev->height;
 		if (updategeom() || dirty) { //if something changed
-			drw_resize(drw, sw, bh);
 			updatebars();
 			for (m = mons; m; m = m->next) {
 				for (c = m->clients; c; c = c->next)
@@ -674,24 +1041,27 @@ void configurerequest(XEvent* e) {
 	XWindowChanges wc;
 
 	if ((c = wintoclient(ev->window))) { //it is a client window
-		if (ev->value_mask & CWBorderWidth) //change border width
+		if (ev->value_mask & CWBorderWidth) { //change border width
 			c->bw = ev->border_width;
-		else if (c->isfloating || !selmon->lt[selmon->sellt]->arrange) { //if window is floating
+			geomgen++;
+		} else if (c->isfloating || !selmon->lt[selmon->sellt]->arrange) { //if window is floating
 			m = c->mon;
+			if (!c->isfloating) //a tiled client may move, its layout must run again
+				geomgen++;
 			if (ev->value_mask & CWX) { //set new X-position
-				c->oldx = c->x;
+				c->info->oldx = c->x;
 				c->x = m->mx + ev->x;
 			}
 			if (ev->value_mask & CWY) { //set new Y-position
-				c->oldy = c->y;
+				c->info->oldy = c->y;
 				c->y = m->my + ev->y;
 			}
 			if (ev->value_mask & CWWidth) { //set new width
-				c->oldw = c->w;
+				c->info->oldw = c->w;
 				c->w = ev->width;
 			}
 			if (ev->value_mask & CWHeight) { //set new height
-				c->oldh = c->h;
+				c->info->oldh = c->h;
 				c->h = ev->height;
 			}
 			if ((c->x + c->w) > m->mx + m->mw && c->isfloating) //hits right edge and is not floating just because of the layout
@@ -699,9 +1069,10 @@ void configurerequest(XEvent* e) {
 			if ((c->y + c->h) > m->my + m->mh && c->isfloating) //hits bottom edge and is not floating just because of the layout
 				c->y = m->my + (m->mh / 2 - HEIGHT(c) / 2); /* center in y direction */
 			if ((ev->value_mask & (CWX|CWY)) && !(ev->value_mask & (CWWidth|CWHeight))) //changed position but not size
-				configure(c); //notify the client
-			if (ISVISIBLE(c)) //otherwise it's pointless
-				XMoveResizeWindow(dpy, c->win, c->x, c->y, c->w, c->h); //configure window position and size
+				configure(c); //notify the client, as ICCCM requires
+			else
+				c->isrequested = 1; //sendgeom() must notify it if nothing is sent
+			queuegeom(c); //configure window position and size
 		} else //didn't change border width, but window is not floating
 			configure(c); //just notify the client, although no changes have been made
 	} else { //it is a window created by the WM
@@ -714,7 +1085,36 @@ void configurerequest(XEvent* e) {
 		wc.stack_mode = ev->detail;
 		XConfigureWindow(dpy, ev->window, ev->value_mask, &wc);
 	}
-	XSync(dpy, False);
+}
+
+void countclient(Client* c, int n) {
+  /*! \brief Add a client to its monitor's tag and urgency counts, or remove it.
+   * \param n [in] 1 to add the client, -1 to remove it.
+   *
+   * Nothing is done unless the client is attached, which attach() and detach()
+   * take care of. Otherwise, Client::tags and Client::isurgent must only change
+   * between removing the client and adding it again, as settags() and seturgent() do.
+  **/
+
+	unsigned int i;
+	Monitor* m = c->mon;
+
+	if (wintoclient(c->win) != c)
+		return;
+	for (i = 0; i < LENGTH(tags); i++)
+		if (c->tags & 1 << i) {
+			if ((m->ntagged[i] += n))
+				m->occ |= 1 << i;
+			else
+				m->occ &= ~(1 << i);
+			if (!c->isurgent)
+				continue;
+			if ((m->nurgent[i] += n))
+				m->urg |= 1 << i;
+			else
+				m->urg &= ~(1 << i);
+		}
+	m->dirty |= DirtyBar;
 }
 
 Monitor* createmon(void) {
@@ -752,10 +1152,18 @@ void detach(Client* c) {
    * \sa attach(), detachstack()
   **/
 
-	Client** tc;
-
-	for (tc = &c->mon->clients; *tc && *tc != c; tc = &(*tc)->next); //find previous client in linked list
-	*tc = c->next; //link it with the next one
+	if (c->prev) //link the previous client with the next one
+		c->prev->next = c->next;
+	else
+		c->mon->clients = c->next;
+	if (c->next) //and the next client with the previous one
+		c->next->prev = c->prev;
+	else
+		c->mon->last = c->prev;
+	countclient(c, -1);
+	unhashwin(c->win);
+	c->mon->tiledvalid = 0;
+	stackchanged = 1;
 }
 
 void detachstack(Client* c) {
@@ -765,10 +1173,16 @@ void detachstack(Client* c) {
    * \sa attachstack(), detach()
   **/
 
-	Client** tc, *t;
+	Client* t;
 
-	for (tc = &c->mon->stack; *tc && *tc != c; tc = &(*tc)->snext); //find element before c in stack
-	*tc = c->snext; //link it to next, skipping c
+	if (c->sprev) //link previous element to next, skipping c
+		c->sprev->snext = c->snext;
+	else
+		c->mon->stack = c->snext;
+	if (c->snext)
+		c->snext->sprev = c->sprev;
+	else
+		c->mon->stail = c->sprev;
 
 	if (c == c->mon->sel) { //if c is selected
 		for (t = c->mon->stack; t && !ISVISIBLE(t); t = t->snext); //find next visible element
@@ -796,67 +1210,114 @@ Monitor* dirtomon(int dir) {
 
 void drawbar(Monitor* m) {
   /*! \brief Draw bar window for the specified monitor.
+   *
+   * The bar is made of segments (see Bar*), and only those whose inputs
+   * changed since they were last drawn are drawn and copied to the window.
+   * Each monitor keeps its bar image in Monitor::barbuf, so the segments
+   * left alone stay valid there. All text is drawn with one Xft call per
+   * color (see drw_flush()), then the changed span is copied to the window
+   * at once. Nothing is done for hidden bars.
+   *
+   * \sa barkey()
   **/
 
-	int x, w, sw = 0;
+	int x, w, tw = 0, sw = 0, k[6];
+	int x0 = m->ww, x1 = 0; //span of the segments drawn
+	unsigned long requests = XNextRequest(dpy), syncs = nsyncs;
 	int boxs = drw->fonts->h / 9; //X and Y position of the small box
 	int boxw = drw->fonts->h / 6 + 2; //width and height of the small box
-	unsigned int i, occ = 0, urg = 0;
-	Client* c;
+	unsigned int i;
 
+	if (!m->showbar)
+		return;
+	drw_setbuf(drw, m->barbuf);
+	for (i = 0; i < LENGTH(tags); i++)
+		tw += TEXTW(tags[i]); //width of all tags
 	/* draw status first so it can be overdrawn by tags later */
-	if (m == selmon) { /* status is only drawn on selected monitor */
-		drw_setscheme(drw, scheme[SchemeNorm]);
+	if (m == selmon) /* status is only drawn on selected monitor */
 		sw = TEXTW(stext) - lrpad + 2; /* 2px right padding */
+	k[0] = m->ww - sw;
+	k[1] = sw;
+	if (barkey(m, BarStatus, k, 2, stext) && sw) {
+		drw_setscheme(drw, scheme[SchemeNorm]);
 		drw_text(drw, m->ww - sw, 0, sw, bh, 0, stext, 0);
+		x0 = MIN(x0, m->ww - sw);
+		x1 = m->ww;
+		if (m->ww - sw < tw + (int)TEXTW(m->ltsymbol)) //overlaps them
+			m->barkeys[BarTags] = m->barkeys[BarLayout] = 0;
 	}
 
   /* draw tags */
-	for (c = m->clients; c; c = c->next) { //for all clients in this monitor
-		occ |= c->tags; //add all tags that the client has
-		if (c->isurgent)
-			urg |= c->tags; //add all tags that the urgent client has
-	}
-	x = 0;
-	for (i = 0; i < LENGTH(tags); i++) { //for every tag
-		w = TEXTW(tags[i]);
-		drw_setscheme(drw, scheme[m->tagset[m->seltags] & 1 << i ? SchemeSel : SchemeNorm]); //set scheme depending on ehether tag is in selected tag list
-		drw_text(drw, x, 0, w, bh, lrpad / 2, tags[i], urg & 1 << i); //draw tag text, invert colors if urgent
-		if (occ & 1 << i) //if there is a window with such tag
-			drw_rect(drw, x + boxs, boxs, boxw, boxw,
-				m == selmon && selmon->sel && selmon->sel->tags & 1 << i,
-				urg & 1 << i); //draw a small box, filled if the selected window has the tag, inverted if urgent
-		x += w;
+	k[0] = m->tagset[m->seltags];
+	k[1] = m->occ;
+	k[2] = m->urg;
+	k[3] = m == selmon && selmon->sel ? selmon->sel->tags : 0;
+	if (barkey(m, BarTags, k, 4, NULL)) {
+		for (x = i = 0; i < LENGTH(tags); i++) { //for every tag
+			w = TEXTW(tags[i]);
+			drw_setscheme(drw, scheme[m->tagset[m->seltags] & 1 << i ? SchemeSel : SchemeNorm]); //set scheme depending on ehether tag is in selected tag list
+			drw_text(drw, x, 0, w, bh, lrpad / 2, tags[i], m->urg & 1 << i); //draw tag text, invert colors if urgent
+			if (m->occ & 1 << i) //if there is a window with such tag
+				drw_rect(drw, x + boxs, boxs, boxw, boxw,
+					m == selmon && selmon->sel && selmon->sel->tags & 1 << i,
+					m->urg & 1 << i); //draw a small box, filled if the selected window has the tag, inverted if urgent
+			x += w;
+		}
+		x0 = 0;
+		x1 = MAX(x1, tw);
 	}
 
   /* draw layout symbol */
+	x = tw;
 	w = blw = TEXTW(m->ltsymbol); //set bar layout symbol width to width of current layout symbol
-	drw_setscheme(drw, scheme[SchemeNorm]);
-	x = drw_text(drw, x, 0, w, bh, lrpad / 2, m->ltsymbol, 0);
-
-	if ((w = m->ww - sw - x) > bh) { //if remaining space > bar height
+	k[0] = x;
+	if (barkey(m, BarLayout, k, 1, m->ltsymbol)) {
+		drw_setscheme(drw, scheme[SchemeNorm]);
+		drw_text(drw, x, 0, w, bh, lrpad / 2, m->ltsymbol, 0);
+		x0 = MIN(x0, x);
+		x1 = MAX(x1, x + w);
+	}
+	x += w;
+
+	w = m->ww - sw - x;
+	k[0] = x;
+	k[1] = w;
+	k[2] = m == selmon;
+	k[3] = m->sel != NULL;
+	k[4] = m->sel && m->sel->isfloating;
+	k[5] = m->sel && m->sel->isfixed;
+	if (barkey(m, BarTitle, k, 6, m->sel ? m->sel->info->name : NULL) && w > bh) { //if remaining space > bar height
     /* draw window title */
 		if (m->sel) { //window title of the selected window
 			drw_setscheme(drw, scheme[m == selmon ? SchemeSel : SchemeNorm]); //scheme indicates if monitor is selected
-			drw_text(drw, x, 0, w, bh, lrpad / 2, m->sel->name, 0);
+			drw_text(drw, x, 0, w, bh, lrpad / 2, m->sel->info->name, 0);
 			if (m->sel->isfloating)
 				drw_rect(drw, x + boxs, boxs, boxw, boxw, m->sel->isfixed, 0); //draw small box if window is floating, fill it if fixed
 		} else { //no title
 			drw_setscheme(drw, scheme[SchemeNorm]);
 			drw_rect(drw, x, 0, w, bh, 1, 1);
 		}
+		x0 = MIN(x0, x);
+		x1 = MAX(x1, x + w);
+	}
+
+	if (x0 < x1) {
+		drw_map(drw, m->barwin, x0, 0, x1 - x0, bh); //copy to actual window
+		barstats.calls++;
+		barstats.requests += XNextRequest(dpy) - requests;
+		barstats.syncs += nsyncs - syncs;
 	}
-	drw_map(drw, m->barwin, 0, 0, m->ww, bh); //map to actual window
 }
 
 void drawbars(void) {
-  /*! \brief Call drawbar() for every monitor.
+  /*! \brief Schedule drawbar() for every monitor.
+   * \sa commit()
   **/
 
 	Monitor* m;
 
 	for (m = mons; m; m = m->next)
-		drawbar(m);
+		m->dirty |= DirtyBar;
 }
 
 void enternotify(XEvent* e) {
@@ -880,6 +1341,29 @@ void enternotify(XEvent* e) {
 	focus(c); //focus on enter window
 }
 
+Window eventwin(XEvent* e) {
+  /*! \brief Get the window an event is about.
+   *
+   * For most events this is XAnyEvent::window, but some events report their
+   * parent window there instead.
+  **/
+
+	switch (e->type) {
+	case ConfigureRequest:
+		return e->xconfigurerequest.window;
+	case ConfigureNotify:
+		return e->xconfigure.window;
+	case DestroyNotify:
+		return e->xdestroywindow.window;
+	case MapRequest:
+		return e->xmaprequest.window;
+	case UnmapNotify:
+		return e->xunmap.window;
+	default:
+		return e->xany.window;
+	}
+}
+
 void expose(XEvent* e) {
   /*! \brief Handler for Expose events.
    * \sa handler
@@ -888,8 +1372,53 @@ void expose(XEvent* e) {
 	Monitor* m;
 	XExposeEvent* ev = &e->xexpose;
 
-	if (ev->count == 0 && (m = wintomon(ev->window))) //only redraw once regardless of the number of Expose events, also only if the window is in a monitor
-		drawbar(m); //Expose events are only received for the bar window
+	if ((m = wintomon(ev->window)) && m->barbuf) { //Expose events are only received for the bar window
+		drw_setbuf(drw, m->barbuf);
+		drw_map(drw, m->barwin, ev->x, ev->y, ev->width, ev->height); //its image is still in the buffer
+		m->dirty |= DirtyBar; //in case something changed since
+	}
+}
+
+WinSlot* findwin(Window w) {
+  /*! \brief Look up a client or bar window in #wintab.
+   *
+   * This is a linear probing hash table kept at most half full,
+   * so a lookup examines very few slots regardless of the number of clients.
+   *
+   * \return The slot holding the window, or NULL if it is not a client or bar window.
+  **/
+
+	unsigned int i;
+
+	nlookups++;
+	if (!wintablen || w == None)
+		return NULL;
+	for (i = WINHASH(w); ; i = (i + 1) & (wintabsize - 1)) {
+		nprobes++;
+		if (wintab[i].win == w)
+			return &wintab[i];
+		if (wintab[i].win == None) //end of the probe sequence
+			return NULL;
+	}
+}
+
+void flushgeom(Monitor* m) {
+  /*! \brief Send the geometry of all clients of a monitor queued by queuegeom().
+   *
+   * Visible windows are configured top down, then hidden ones bottom up, so
+   * that fewer windows get exposed in between.
+  **/
+
+	Client* c, *last = NULL;
+
+	for (c = m->stack; c; c = c->snext) {
+		last = c;
+		if (c->ispending && !c->ishidden)
+			sendgeom(c);
+	}
+	for (c = last; c; c = c->sprev)
+		if (c->ispending)
+			sendgeom(c);
 }
 
 void focus(Client* c) {
@@ -921,9 +1450,23 @@ void focus(Client* c) {
 		XDeleteProperty(dpy, root, netatom[NetActiveWindow]);
 	}
 	selmon->sel = c;
+	if (lazymonocle && selmon->lt[selmon->sellt]->arrange == monocle)
+		selmon->dirty |= DirtyLayout; //the new selection must be sized
 	drawbars();
 }
 
+void freeclient(Client* c) {
+  /*! \brief Return a client to #freeclients, releasing its title.
+   * \sa newclient()
+  **/
+
+	free(c->info->name);
+	if (c->ispending)
+		npending--;
+	c->next = freeclients;
+	freeclients = c;
+}
+
 void focusin(XEvent* e) {
   /*! \brief Handler for FocusIn events.
    * \sa handler
@@ -961,7 +1504,7 @@ void focusstack(const Arg* arg) {
    * \sa keys
   **/
 
-	Client* c = NULL, *i;
+	Client* c = NULL;
 
 	if (!selmon->sel)
 		return;
@@ -970,38 +1513,42 @@ void focusstack(const Arg* arg) {
 		if (!c) //if we reached the end
 			for (c = selmon->clients; c && !ISVISIBLE(c); c = c->next); //first visible window
 	} else {
-		for (i = selmon->clients; i != selmon->sel; i = i->next) //for all clients up to and not including the selected one
-			if (ISVISIBLE(i)) //only those which are visible
-				c = i; //at the end, c will be set to the previous visible client to the selected one
-		if (!c) //if the selected client is the first
-			for (; i; i = i->next) //find the last visible client
-				if (ISVISIBLE(i))
-					c = i;
+		for (c = selmon->sel->prev; c && !ISVISIBLE(c); c = c->prev); //previous visible window from the selected one
+		if (!c) //if we reached the beginning
+			for (c = selmon->last; c && !ISVISIBLE(c); c = c->prev); //last visible window
 	}
 	if (c) { //if we found a client
 		focus(c);
-		restack(selmon);
+		selmon->dirty |= DirtyStack;
 	}
 }
 
-Atom getatomprop(Client* c, Atom prop) {
-  /*! \brief Get client window property as atom.
-   * \param c [in] Client to get property from
-   * \param prop [in] Atom representing property to obtain
-   * \return None if the property could not be obtained, or the property otherwise.
+void getprops(const Window* w, const Atom* a, unsigned int n, Prop** r) {
+  /*! \brief Get several window properties in a single round trip.
+   * \param w [in] Window of each property.
+   * \param a [in] Atom of each property.
+   * \param n [in] Number of properties.
+   * \param r [out] Reply for each property, or NULL if it could not be
+   * obtained. Each one must be released with *free(3)*.
+   *
+   * All requests are sent through XCB before waiting for any reply.
+   *
+   * \sa propdata()
   **/
 
-	int di;
-	unsigned long dl;
-	unsigned char* p = NULL;
-	Atom da, atom = None;
-
-	if (XGetWindowProperty(dpy, c->win, prop, 0L, sizeof atom, False, XA_ATOM,
-		&da, &di, &dl, &dl, &p) == Success && p) {
-		atom = *(Atom*)p;
-		XFree(p);
+	unsigned int i;
+	xcb_get_property_cookie_t* ck = ecalloc(n, sizeof(xcb_get_property_cookie_t));
+	xcb_generic_error_t* e;
+
+	for (i = 0; i < n; i++)
+		ck[i] = xcb_get_property(xcon, 0, w[i], a[i], XCB_GET_PROPERTY_TYPE_ANY, 0, 1000000);
+	if (n)
+		nsyncs++; //one wait for all the replies
+	for (i = 0; i < n; i++) {
+		r[i] = xcb_get_property_reply(xcon, ck[i], &e);
+		free(e); //errors such as BadWindow are expected, see xerror()
 	}
-	return atom;
+	free(ck);
 }
 
 int getrootptr(int* x, int* y) {
@@ -1013,30 +1560,10 @@ int getrootptr(int* x, int* y) {
 	unsigned int dui;
 	Window dummy;
 
+	nsyncs++;
 	return XQueryPointer(dpy, root, &dummy, &dummy, x, y, &di, &di, &dui);
 }
 
-long getstate(Window w) {
-  /*! \brief Get a certain window's WM_STATE property.
-   *
-   * \return -1 if the state could not be obtained, the property's value otherwise.
-  **/
-
-	int format;
-	long result = -1;
-	unsigned char* p = NULL;
-	unsigned long n, extra;
-	Atom real;
-
-	if (XGetWindowProperty(dpy, w, wmatom[WMState], 0L, 2L, False, wmatom[WMState],
-		&real, &format, &n, &extra, (unsigned char**)&p) != Success)
-		return -1;
-	if (n != 0) //if the number of items returned is not zero
-		result = *p;
-	XFree(p);
-	return result;
-}
-
 int gettextprop(Window w, Atom atom, char* text, unsigned int size) {
   /*! \brief Get window property as text.
    * \param w [in] Window to get property from
@@ -1045,25 +1572,19 @@ int gettextprop(Window w, Atom atom, char* text, unsigned int size) {
    * \param size [in] Size of the buffer that will hold the string
   **/
 
-	char** list = NULL;
-	int n;
-	XTextProperty name;
+	char* t;
+	Prop* r;
 
 	if (!text || size == 0)
 		return 0;
 	text[0] = '\0';
-	if (!XGetTextProperty(dpy, w, &name, atom) || !name.nitems) //try to get window property from atom
+	getprops(&w, &atom, 1, &r);
+	t = proptext(r);
+	free(r);
+	if (!t)
 		return 0;
-	if (name.encoding == XA_STRING) //if returned data is a string
-		strncpy(text, (char*)name.value, size - 1);
-	else {
-		if (XmbTextPropertyToTextList(dpy, &name, &list, &n) >= Success && n > 0 && *list) { //try to convert property into a list of string
-			strncpy(text, *list, size - 1); //use first element
-			XFreeStringList(list);
-		}
-	}
-	text[size - 1] = '\0';
-	XFree(name.value); //free original string
+	snprintf(text, size, "%s", t);
+	free(t);
 	return 1;
 }
 
@@ -1110,6 +1631,50 @@ void grabkeys(void) {
 	}
 }
 
+uint64_t hashbytes(uint64_t h, const void* p, size_t n) {
+  /*! \brief Hash some bytes with 64-bit FNV-1a.
+   * \param h [in] Hash of the preceding bytes, or 0 to start.
+   * \return The hash, never 0.
+  **/
+
+	const unsigned char* b = p;
+
+	if (!h)
+		h = 14695981039346656037ull; //offset basis
+	while (n--)
+		h = (h ^ *b++) * 1099511628211ull;
+	return h ? h : 1;
+}
+
+void hashwin(Window w, Client* c, Monitor* m) {
+  /*! \brief Add a window to #wintab, or update its entry.
+   * \param c [in] Client of the window, or NULL
+   * \param m [in] Monitor whose bar is the window, or NULL
+   * \sa findwin(), unhashwin()
+  **/
+
+	unsigned int i, n;
+	WinSlot* old = wintab;
+
+	if (2 * (wintablen + 1) > wintabsize) { //grow and rehash, so that at least half the slots are free
+		n = wintabsize;
+		wintabsize = n ? 2 * n : 64;
+		wintab = ecalloc(wintabsize, sizeof(WinSlot));
+		for (; n--; )
+			if (old[n].win != None) {
+				for (i = WINHASH(old[n].win); wintab[i].win != None; i = (i + 1) & (wintabsize - 1));
+				wintab[i] = old[n];
+			}
+		free(old);
+	}
+	for (i = WINHASH(w); wintab[i].win != None && wintab[i].win != w; i = (i + 1) & (wintabsize - 1));
+	if (wintab[i].win == None)
+		wintablen++;
+	wintab[i].win = w;
+	wintab[i].c = c;
+	wintab[i].m = m;
+}
+
 void incnmaster(const Arg* arg) {
   /*! \brief Increase or decrease the maximum number of windows in the master area by the specified amount.
    * \param arg [in] The amount specified in its Arg::i field is added to the current setting.
@@ -1169,36 +1734,83 @@ void killclient(const Arg* arg) {
 		XSetErrorHandler(xerrordummy); //ignore errors
 		XSetCloseDownMode(dpy, DestroyAll); //make sure that all client resources will be destroyed
 		XKillClient(dpy, selmon->sel->win); //kill it
-		XSync(dpy, False);
+		xsync();
 		XSetErrorHandler(xerror);
 		XUngrabServer(dpy);
 	}
 }
 
-void manage(Window w, XWindowAttributes* wa) {
+uint64_t layoutsig(Monitor* m) {
+  /*! \brief Compute a signature of everything a monitor's layout depends on.
+   *
+   * That is the layout, its parameters, the window area, the visible tiled
+   * clients in order and #geomgen.
+   *
+   * \sa arrangemon()
+  **/
+
+	struct {
+		const Layout* lt;
+		float mfact;
+		int nmaster, wx, wy, ww, wh;
+		unsigned int nvisible, ntiled;
+		unsigned long gen;
+		const Client* sel;
+	} in;
+	memset(&in, 0, sizeof in); //also padding
+	in.lt = m->lt[m->sellt];
+	in.mfact = m->mfact;
+	in.nmaster = m->nmaster;
+	in.wx = m->wx;
+	in.wy = m->wy;
+	in.ww = m->ww;
+	in.wh = m->wh;
+	in.nvisible = m->nvisible; //shown in the monocle symbol
+	in.ntiled = m->ntiled;
+	in.gen = geomgen;
+	if (lazymonocle && in.lt->arrange == monocle)
+		in.sel = m->sel; //it depends on the selection too
+	return hashbytes(hashbytes(0, &in, sizeof in), m->tiled, m->ntiled * sizeof(Client*));
+}
+
+void manage(Window w, XWindowAttributes* wa, Prop** props) {
   /*! \brief Integrates a new window into the WM, creating a client for it.
+   * \param props [in] Properties requested as by clientprops(), or NULL to fetch them here
   **/
 
 	Client* c, *t = NULL;
 	Window trans = None;
 	XWindowChanges wc;
+	Window pw[PropLast];
+	Atom pa[PropLast];
+	Prop* own[PropLast], **r = props;
+	uint32_t* v;
+	int i;
 
-	c = ecalloc(1, sizeof(Client)); //create a client for the window
+	c = newclient(); //create a client for the window
 	c->win = w;
 	/* geometry */
-	c->x = c->oldx = wa->x;
-	c->y = c->oldy = wa->y;
-	c->w = c->oldw = wa->width;
-	c->h = c->oldh = wa->height;
-	c->oldbw = wa->border_width;
-
-	updatetitle(c);
-	if (XGetTransientForHint(dpy, w, &trans) && (t = wintoclient(trans))) { //is a transient window of trans
+	c->x = c->info->oldx = wa->x;
+	c->y = c->info->oldy = wa->y;
+	c->w = c->info->oldw = wa->width;
+	c->h = c->info->oldh = wa->height;
+	c->info->oldbw = wa->border_width;
+
+	if (!r) { //get all needed properties at once, instead of a round trip for each
+		clientprops(w, pw, pa);
+		getprops(pw, pa, PropLast, own);
+		r = own;
+	}
+
+	settitle(c, r[PropNetWMName], r[PropWMName]);
+	if ((v = propdata(r[PropTransient], XA_WINDOW, 32, 1)))
+		trans = *v;
+	if (trans != None && (t = wintoclient(trans))) { //is a transient window of trans
 		c->mon = t->mon; //same monitor as top-level window
 		c->tags = t->tags; //same tags as top-level window
 	} else {
 		c->mon = selmon; //put window in selected monitor
-		applyrules(c);
+		applyrules(c, r[PropClass]);
 	}
 
 	if (c->x + WIDTH(c) > c->mon->mx + c->mon->mw)
@@ -1211,32 +1823,44 @@ void manage(Window w, XWindowAttributes* wa) {
 		&& (c->x + (c->w / 2) < c->mon->wx + c->mon->ww)) ? bh : c->mon->my); //if window crosses top edge or its X-center is on the bar, move it down
 	c->bw = borderpx;
 
-	wc.border_width = c->bw;
+	wc.border_width = c->cbw = c->bw;
 	XConfigureWindow(dpy, w, CWBorderWidth, &wc);
 	XSetWindowBorder(dpy, w, scheme[SchemeNorm][ColBorder].pixel);
 	configure(c); /* propagates border_width, if size doesn't change */
   /* get other client values from the client's window */
-	updatewindowtype(c);
-	updatesizehints(c);
-	updatewmhints(c);
+	setwindowtype(c, r[PropState], r[PropWindowType]);
+	setsizehints(c, r[PropNormalHints]);
+	setwmhints(c, r[PropHints]);
+	if (r == own)
+		for (i = 0; i < PropLast; i++)
+			free(own[i]);
 
 	XSelectInput(dpy, w, EnterWindowMask|FocusChangeMask|PropertyChangeMask|StructureNotifyMask);
 	grabbuttons(c, 0); //grab all button presses away from the non-focused window
 	if (!c->isfloating)
 		c->isfloating = c->oldstate = trans != None || c->isfixed; //transient windows and fixed-size windows are floating
 	if (c->isfloating)
-		XRaiseWindow(dpy, c->win); //floating windows are visible on top of all others
+		raiseclient(c); //floating windows are visible on top of all others
 	attach(c);
 	attachstack(c);
-	XChangeProperty(dpy, root, netatom[NetClientList], XA_WINDOW, 32, PropModeAppend,
-		(unsigned char*) &(c->win), 1); //append to client list
+	if (!adopting)
+		XChangeProperty(dpy, root, netatom[NetClientList], XA_WINDOW, 32, PropModeAppend,
+			(unsigned char*) &(c->win), 1); //append to client list
 	XMoveResizeWindow(dpy, c->win, c->x + 2 * sw, c->y, c->w, c->h); /* some windows require this */
+	c->cx = c->x + 2 * sw;
+	c->cy = c->y;
+	c->cw = c->w;
+	c->ch = c->h;
+	c->ishidden = 1; //until it is shown by showhide()
 	setclientstate(c, NormalState);
-	if (c->mon == selmon)
+	if (c->mon == selmon && !adopting)
 		unfocus(selmon->sel, 0); //unfocus the previously focused window
 	c->mon->sel = c; //and select the new client
-	arrange(c->mon);
+	c->mon->raised = None; //new windows are mapped above all others
 	XMapWindow(dpy, c->win);
+	if (adopting)
+		return;
+	arrange(c->mon);
 	focus(NULL); //focus the first visible window in the selected monitor
 }
 
@@ -1260,29 +1884,38 @@ void maprequest(XEvent* e) {
 	static XWindowAttributes wa;
 	XMapRequestEvent* ev = &e->xmaprequest;
 
+	nsyncs++;
 	if (!XGetWindowAttributes(dpy, ev->window, &wa))
 		return;
 	if (wa.override_redirect) //let the window do its own thing
 		return;
 	if (!wintoclient(ev->window)) //window doesn't have a client yet
-		manage(ev->window, &wa);
+		manage(ev->window, &wa, NULL);
 }
 
-void monocle(Monitor* m) {
+void monocle(Monitor* m, Client** tiled, unsigned int n) {
   /*! \brief Arrange callback for the monocle layout.
+   *
+   * If #lazymonocle is set, only the selected client is maximized, and the
+   * others when they get selected.
+   *
    * \sa layouts
   **/
 
-	unsigned int n = 0;
+	unsigned int i;
 	Client* c;
 
-	for (c = m->clients; c; c = c->next)
-		if (ISVISIBLE(c))
-			n++; //count visible windows
-	if (n > 0) /* override layout symbol */
-		snprintf(m->ltsymbol, sizeof m->ltsymbol, "[%d]", n);
-	for (c = nexttiled(m->clients); c; c = nexttiled(c->next))
-		resize(c, m->wx, m->wy, m->ww - 2 * c->bw, m->wh - 2 * c->bw, 0); //maximize all clients
+	if (m->nvisible > 0) /* override layout symbol */
+		snprintf(m->ltsymbol, sizeof m->ltsymbol, "[%d]", m->nvisible);
+	if (lazymonocle) { //only size the client on top, the others are hidden below it anyway
+		if (!(c = m->sel) || c->isfloating || !ISVISIBLE(c))
+			for (c = m->stack; c && (c->isfloating || !ISVISIBLE(c)); c = c->snext); //topmost tiled client
+		if (c)
+			resize(c, m->wx, m->wy, m->ww - 2 * c->bw, m->wh - 2 * c->bw, 0);
+		return;
+	}
+	for (i = 0; i < n; i++)
+		resize(tiled[i], m->wx, m->wy, m->ww - 2 * tiled[i]->bw, m->wh - 2 * tiled[i]->bw, 0); //maximize all clients
 }
 
 void motionnotify(XEvent* e) {
@@ -1304,6 +1937,41 @@ void motionnotify(XEvent* e) {
 	mon = m;
 }
 
+Client* newclient(void) {
+  /*! \brief Allocate a zeroed client.
+   *
+   * Clients are taken from blocks of #SLABSIZE, so that those traversed
+   * together by layouts and visibility checks lie close in memory. Data
+   * only needed by a few operations is kept apart in Client::info.
+   *
+   * \sa freeclient()
+  **/
+
+	Client* c;
+	ClientInfo* info;
+	Slab* s;
+	int i;
+
+	if (!freeclients) { //allocate a new block
+		s = ecalloc(1, sizeof(Slab));
+		s->next = slabs;
+		slabs = s;
+		for (i = SLABSIZE - 1; i >= 0; i--) { //the first ones in the block are used first
+			s->clients[i].info = &s->infos[i];
+			s->clients[i].next = freeclients;
+			freeclients = &s->clients[i];
+		}
+	}
+	c = freeclients;
+	freeclients = c->next;
+	info = c->info;
+	memset(c, 0, sizeof(Client));
+	memset(info, 0, sizeof(ClientInfo));
+	c->info = info;
+	geomgen++; //it may reuse the address of a client in some Monitor::tiled
+	return c;
+}
+
 void movemouse(const Arg* arg) {
   /*! \brief Move the selected window using the mouse.
    *
@@ -1324,7 +1992,8 @@ void movemouse(const Arg* arg) {
 		return;
 	if (c->isfullscreen) /* no support moving fullscreen windows by mouse */
 		return;
-	restack(selmon);
+	selmon->dirty |= DirtyStack;
+	commit(); //apply anything pending before the grab
 	ocx = c->x; //original client position
 	ocy = c->y;
 	if (XGrabPointer(dpy, root, False, MOUSEMASK, GrabModeAsync, GrabModeAsync,
@@ -1362,6 +2031,7 @@ void movemouse(const Arg* arg) {
 				resize(c, nx, ny, c->w, c->h, 1); //if the window is floating, move it to the new postion, possibly crossing monitor boundaries
 			break;
 		}
+		commit(); //there is no batch to commit after
 	} while (ev.type != ButtonRelease);
 	XUngrabPointer(dpy, CurrentTime);
 	if ((m = recttomon(c->x, c->y, c->w, c->h)) != selmon) { //if the client is lying mostly on another monitor
@@ -1389,6 +2059,59 @@ void pop(Client* c) {
 	arrange(c->mon);
 }
 
+void printstats(void) {
+  /*! \brief Print performance counters to stderr.
+   * \sa showstats
+  **/
+
+	unsigned int i, nfonts;
+	int depth, bpp;
+	unsigned long barpixels = 0, glyphbytes;
+	Monitor* m;
+
+	fprintf(stderr, "dwm: %-16s %10s %10s %10s\n", "handler", "calls", "requests", "roundtrips");
+	for (i = 0; i < LASTEvent; i++)
+		if (evstats[i].calls)
+			fprintf(stderr, "dwm: %-16s %10lu %10lu %10lu\n", evname[i],
+				evstats[i].calls, evstats[i].requests, evstats[i].syncs);
+	fprintf(stderr, "dwm: %-16s %10lu %10lu %10lu\n", "commit",
+		commitstats.calls, commitstats.requests, commitstats.syncs);
+	fprintf(stderr, "dwm: %-16s %10lu %10lu %10lu\n", "drawbar",
+		barstats.calls, barstats.requests, barstats.syncs);
+	fprintf(stderr, "dwm: %lu layouts run, %lu skipped as unchanged\n", nsigmisses, nsighits);
+	fprintf(stderr, "dwm: %lu arranges, %.2f configures sent and %.2f unchanged geometries skipped per arrange\n",
+		arrangestats.arranges,
+		arrangestats.arranges ? (double) arrangestats.configures / arrangestats.arranges : 0.0,
+		arrangestats.arranges ? (double) arrangestats.unchanged / arrangestats.arranges : 0.0);
+	fprintf(stderr, "dwm: %u windows indexed, %lu lookups, %.2f slots examined per lookup\n",
+		wintablen, nlookups, nlookups ? (double) nprobes / nlookups : 0.0);
+	fprintf(stderr, "dwm: %lu texts shaped, %lu reused from the cache\n", drw->shapemisses, drw->shapehits);
+	fprintf(stderr, "dwm: %lu character fonts looked up, %lu reused from the cache\n", drw->charmisses, drw->charhits);
+	fprintf(stderr, "dwm: %lu fontconfig searches, %lu avoided\n", drw->matchmisses, drw->matchhits);
+	drw_fontset_getstats(drw, &nfonts, &glyphbytes);
+	fprintf(stderr, "dwm: %u fonts open, about %lu KiB of glyphs cached\n", nfonts, glyphbytes / 1024);
+	for (m = mons; m; m = m->next)
+		barpixels += (unsigned long) m->ww * bh;
+	depth = DefaultDepth(dpy, screen);
+	bpp = depth > 16 ? 4 : depth > 8 ? 2 : 1; //bytes per pixel the server most likely uses
+	fprintf(stderr, "dwm: bar buffers take %lu KiB, a screen-sized one would take %lu KiB\n",
+		barpixels * bpp / 1024, (unsigned long) sw * sh * bpp / 1024);
+}
+
+void* propdata(Prop* r, Atom type, int format, unsigned int n) {
+  /*! \brief Get the value of a property, checking its type.
+   * \param r [in] The property, or NULL.
+   * \param type [in] Expected type, or AnyPropertyType.
+   * \param format [in] Expected format (8, 16 or 32 bits per item).
+   * \param n [in] Minimum number of items.
+   * \return The items, or NULL if the property does not exist or does not match.
+  **/
+
+	if (!r || (type != AnyPropertyType && r->type != type) || r->format != format || r->value_len < n)
+		return NULL;
+	return xcb_get_property_value(r);
+}
+
 void propertynotify(XEvent* e) {
   /*! \brief Handler for PropertyNotify events.
    * \sa handler
@@ -1406,9 +2129,12 @@ void propertynotify(XEvent* e) {
 		switch(ev->atom) {
 		default: break;
 		case XA_WM_TRANSIENT_FOR:
+			nsyncs += !c->isfloating;
 			if (!c->isfloating && (XGetTransientForHint(dpy, c->win, &trans)) && //window is not floating and is transient of another window
-				(c->isfloating = (wintoclient(trans)) != NULL)) //if that window is from a client, make it floating and...
+				wintoclient(trans)) { //if that window is from a client, make it floating and...
+				setfloating(c, 1);
 				arrange(c->mon);
+			}
 			break;
 		case XA_WM_NORMAL_HINTS:
 			updatesizehints(c); //get the new size hints
@@ -1421,13 +2147,123 @@ void propertynotify(XEvent* e) {
 		if (ev->atom == XA_WM_NAME || ev->atom == netatom[NetWMName]) { //window title changed
 			updatetitle(c);
 			if (c == c->mon->sel) //if the selected window's title changes
-				drawbar(c->mon); //the window title bar must be redrawn
+				c->mon->dirty |= DirtyBar; //the window title bar must be redrawn
 		}
 		if (ev->atom == netatom[NetWMWindowType]) //window type changed
 			updatewindowtype(c);
 	}
 }
 
+void queueevent(XEvent* e) {
+  /*! \brief Append an event to the batch in #evq, coalescing it with older ones.
+   *
+   * The newest event for the same window in the batch is looked up. If it is
+   * superseded by the new one, it is dropped by setting its type to 0:
+   *   * MotionNotify replaces an older MotionNotify.
+   *   * PropertyNotify replaces an older one for the same property, both
+   *   title properties counting as one, unless the property was deleted.
+   *   * ConfigureRequest is merged with an older one, unless only one of them
+   *   changes the border width (see configurerequest()).
+   *
+   * Any other event for the same window stops the search, so events for a
+   * window are never reordered.
+   *
+   * \sa xevents()
+  **/
+
+	unsigned int i;
+	Window w = eventwin(e);
+	Atom a, oa;
+	XEvent* o;
+	XConfigureRequestEvent* cr = &e->xconfigurerequest, *ocr;
+
+	for (i = evqlen; i-- > 0;) { //search backwards
+		o = &evq[i];
+		if (!o->type || eventwin(o) != w) //already dropped, or about another window
+			continue;
+		if (o->type != e->type) //something else happened to this window in between
+			break;
+		if (e->type == MotionNotify)
+			o->type = 0; //only the latest pointer position matters
+		else if (e->type == PropertyNotify) {
+			a = e->xproperty.atom;
+			oa = o->xproperty.atom;
+			if (w != root && a == XA_WM_NAME) //both title properties result in updatetitle()
+				a = netatom[NetWMName];
+			if (w != root && oa == XA_WM_NAME)
+				oa = netatom[NetWMName];
+			if (a != oa) //another property, keep looking
+				continue;
+			if (e->xproperty.state != PropertyDelete) //handler will read the latest value anyway
+				o->type = 0;
+		} else if (e->type == ConfigureRequest) {
+			ocr = &o->xconfigurerequest;
+			if ((cr->value_mask ^ ocr->value_mask) & CWBorderWidth) //handled differently, cannot merge
+				break;
+			if (!(cr->value_mask & CWX))
+				cr->x = ocr->x;
+			if (!(cr->value_mask & CWY))
+				cr->y = ocr->y;
+			if (!(cr->value_mask & CWWidth))
+				cr->width = ocr->width;
+			if (!(cr->value_mask & CWHeight))
+				cr->height = ocr->height;
+			if (!(cr->value_mask & CWBorderWidth))
+				cr->border_width = ocr->border_width;
+			if (!(cr->value_mask & CWSibling))
+				cr->above = ocr->above;
+			if (!(cr->value_mask & CWStackMode))
+				cr->detail = ocr->detail;
+			cr->value_mask |= ocr->value_mask; //new values take precedence over old ones
+			o->type = 0;
+		}
+		break;
+	}
+	evq[evqlen++] = *e;
+}
+
+char* proptext(Prop* r) {
+  /*! \brief Get a property as text.
+   * \param r [in] The property, or NULL.
+   * \return A newly allocated string, empty if it cannot be converted, or NULL if the property does not exist.
+  **/
+
+	char** list = NULL;
+	char* text = NULL;
+	int n;
+	XTextProperty name;
+
+	if (!(name.value = propdata(r, AnyPropertyType, 8, 1)))
+		return NULL;
+	name.encoding = r->type;
+	name.format = r->format;
+	name.nitems = r->value_len;
+	if (name.encoding == XA_STRING) { //if returned data is a string
+		text = ecalloc(name.nitems + 1, 1);
+		memcpy(text, name.value, name.nitems); //not null-terminated
+	} else if (XmbTextPropertyToTextList(dpy, &name, &list, &n) >= Success && n > 0 && *list) { //try to convert property into a list of string
+		text = ecalloc(strlen(*list) + 1, 1);
+		strcpy(text, *list); //use first element
+		XFreeStringList(list);
+	}
+	return text ? text : ecalloc(1, 1);
+}
+
+void queuegeom(Client* c) {
+  /*! \brief Schedule a client's window to be configured by commit().
+   *
+   * Its geometry is only compared against the one last sent then, so
+   * layouts can move clients several times per batch at no cost.
+   *
+   * \sa resizeclient(), sendgeom()
+  **/
+
+	if (!c->ispending) {
+		c->ispending = 1;
+		npending++;
+	}
+}
+
 void quit(const Arg* arg) {
   /*! \brief Quit dwm.
    * \sa keys, main()
@@ -1436,6 +2272,16 @@ void quit(const Arg* arg) {
 	running = 0; //see main()
 }
 
+void raiseclient(Client* c) {
+  /*! \brief Raise a client's window to the top of the X stack, outside of restack().
+  **/
+
+	XRaiseWindow(dpy, c->win);
+	c->stackpos = 0; //no longer where restack() left it
+	c->mon->raised = None;
+	stackchanged = 1;
+}
+
 Monitor* recttomon(int x, int y, int w, int h) {
   /*! \brief Get monitor that overlaps the most with a given rectangle.
    *
@@ -1465,22 +2311,21 @@ void resize(Client* c, int x, int y, int w, int h, int interact) {
 
 	if (applysizehints(c, &x, &y, &w, &h, interact)) //if the obtained values are different from the client's
 		resizeclient(c, x, y, w, h);
+	else
+		nunchanged++;
 }
 
 void resizeclient(Client* c, int x, int y, int w, int h) {
   /*! \brief Change client's window geometry. Does not take into account size hints (cf. resize()).
   **/
 
-	XWindowChanges wc;
-
-	c->oldx = c->x; c->x = wc.x = x;
-	c->oldy = c->y; c->y = wc.y = y;
-	c->oldw = c->w; c->w = wc.width = w;
-	c->oldh = c->h; c->h = wc.height = h;
-	wc.border_width = c->bw;
-	XConfigureWindow(dpy, c->win, CWX|CWY|CWWidth|CWHeight|CWBorderWidth, &wc);
-	configure(c);
-	XSync(dpy, False);
+	c->info->oldx = c->x; c->x = x;
+	c->info->oldy = c->y; c->y = y;
+	c->info->oldw = c->w; c->w = w;
+	c->info->oldh = c->h; c->h = h;
+	queuegeom(c); //sent by commit(), together with all others
+	if (!arranging) //a layout may need to put it back
+		geomgen++;
 }
 
 void resizemouse(const Arg* arg) {
@@ -1503,7 +2348,8 @@ void resizemouse(const Arg* arg) {
 		return;
 	if (c->isfullscreen) /* no support resizing fullscreen windows by mouse */
 		return;
-	restack(selmon);
+	selmon->dirty |= DirtyStack;
+	commit(); //apply anything pending before the grab
 	ocx = c->x; //original client position
 	ocy = c->y;
 	if (XGrabPointer(dpy, root, False, MOUSEMASK, GrabModeAsync, GrabModeAsync,
@@ -1536,10 +2382,11 @@ void resizemouse(const Arg* arg) {
 				resize(c, c->x, c->y, nw, nh, 1); //if the window is floating, set it to the new size, possibly crossing monitor boundaries
 			break;
 		}
+		commit(); //there is no batch to commit after
 	} while (ev.type != ButtonRelease);
 	XWarpPointer(dpy, None, c->win, 0, 0, 0, 0, c->w + c->bw - 1, c->h + c->bw - 1); //warp pointer to the bottom-right corner of the client, in case it isn't there
 	XUngrabPointer(dpy, CurrentTime);
-	while (XCheckMaskEvent(dpy, EnterWindowMask, &ev)); //remove all EnterNotify events from the queue
+	skipenters();
 	if ((m = recttomon(c->x, c->y, c->w, c->h)) != selmon) { //if the client is lying mostly on another monitor
 		sendmon(c, m);
 		selmon = m;
@@ -1554,68 +2401,267 @@ void restack(Monitor* m) {
    * the bar window, and finally all the other client windows in the order they
    * appear in Monitor::stack. If the selected layout of the monitor is
    * floating, however, all windows will be floating. All windows are redrawn.
+   *
+   * Only the changes from the order sent last time, Monitor::stacked, are
+   * sent: the windows that keep their relative order (a longest increasing
+   * subsequence of their old positions) stay, and each of the others is placed
+   * below its predecessor. Nothing is sent if the order did not change.
+   *
+   * The caller must get rid of the EnterNotify events this generates, see
+   * commit().
   **/
 
 	Client* c;
-	XEvent ev;
 	XWindowChanges wc;
+	Window* w;
+	int i, n, lo, hi, len, *pos, *tail, *prev;
+	char* keep;
 
 	drawbar(m);
 	if (!m->sel) //no client window selected, nothing to do
 		return;
-	if (m->sel->isfloating || !m->lt[m->sellt]->arrange) //if selected window or whole monitor layout is floating
+	if ((m->sel->isfloating || !m->lt[m->sellt]->arrange) //if selected window or whole monitor layout is floating
+	&& m->raised != m->sel->win) { //and it is not already on top
 		XRaiseWindow(dpy, m->sel->win); //raise to top of the X stack
-	if (m->lt[m->sellt]->arrange) { //monitor has a selected layout (non-floating)
-		wc.stack_mode = Below;  // place first window below...
-		wc.sibling = m->barwin; //...the bar window in the X stack
-		for (c = m->stack; c; c = c->snext)
-			if (!c->isfloating && ISVISIBLE(c)) { //for all non-floating windows in monitor
-				XConfigureWindow(dpy, c->win, CWSibling|CWStackMode, &wc); //apply settings created before
-				wc.sibling = c->win; //place next window below the current one in the X stack
-			}
+		m->raised = m->sel->win;
+		if (!m->sel->isfloating) //it left its place in Monitor::stacked, so the next diff must not trust it
+			m->nstacked = 0;
+		stackchanged = 1;
 	}
-	XSync(dpy, False);
-	while (XCheckMaskEvent(dpy, EnterWindowMask, &ev)); //remove al pending EnterNotify events, as they were created in an outdated layout
+	if (!m->lt[m->sellt]->arrange) //monitor has no selected layout (floating)
+		return;
+
+	for (n = 1, c = m->stack; c; c = c->snext)
+		n += !c->isfloating && ISVISIBLE(c);
+	w = ecalloc(n, sizeof(Window));
+	pos = ecalloc(n, sizeof(int));
+	w[0] = m->barwin; //first window stays...
+	pos[0] = m->nstacked ? 0 : -1;
+	for (i = 1, c = m->stack; c; c = c->snext)
+		if (!c->isfloating && ISVISIBLE(c)) { //...and all non-floating windows in monitor go below it
+			w[i] = c->win;
+			pos[i] = c->stackpos < m->nstacked && m->stacked[c->stackpos] == c->win
+				? (int)c->stackpos : -1; //where it was last time, if anywhere
+			c->stackpos = i++;
+		}
+	for (i = 0; i < n && pos[i] == i; i++);
+	if (i == n && n == (int)m->nstacked) { //nothing moved
+		free(w);
+		free(pos);
+		return;
+	}
+
+	tail = ecalloc(n, sizeof(int)); //tail[l] is the last element of the best subsequence of length l + 1
+	prev = ecalloc(n, sizeof(int)); //previous element in the subsequence
+	keep = ecalloc(n, 1);
+	for (i = len = 0; i < n; i++) {
+		if (pos[i] < 0)
+			continue;
+		for (lo = 0, hi = len; lo < hi; ) { //find the first tail not below this one
+			if (pos[tail[(lo + hi) / 2]] < pos[i])
+				lo = (lo + hi) / 2 + 1;
+			else
+				hi = (lo + hi) / 2;
+		}
+		prev[i] = lo ? tail[lo - 1] : -1;
+		tail[lo] = i;
+		if (lo == len)
+			len++;
+	}
+	for (i = len ? tail[len - 1] : -1; i >= 0; i = prev[i])
+		keep[i] = 1;
+	wc.stack_mode = Below;
+	for (i = 1; i < n; i++)
+		if (!keep[i]) {
+			wc.sibling = w[i - 1]; //place it below the previous window in the X stack
+			XConfigureWindow(dpy, w[i], CWSibling|CWStackMode, &wc);
+		}
+
+	free(m->stacked);
+	m->stacked = w;
+	m->nstacked = n;
+	stackchanged = 1;
+	free(pos);
+	free(tail);
+	free(prev);
+	free(keep);
 }
 
 void run(void) {
   /*! \brief Main program loop.
+   *
+   * Waits with epoll(7) on the X connection and on #watches. Pending X events
+   * are always dispatched first, since Xlib may already have read them from
+   * the connection.
   **/
 
-	XEvent ev;
+	int i, n;
+	struct epoll_event evs[LENGTH(watches)];
+	Watch* w;
+
 	/* main event loop */
-	XSync(dpy, False); //flush X server
-	while (running && !XNextEvent(dpy, &ev)) //wait for event
-		if (handler[ev.type])
-			handler[ev.type](&ev); /* call handler */
+	commit(); //apply updates scheduled by setup() and scan()
+	while (running) {
+		xevents();
+		if (!running)
+			break;
+		if ((n = epoll_wait(epfd, evs, LENGTH(evs), -1)) < 0) { //wait for events
+			if (errno == EINTR)
+				continue;
+			die("epoll_wait:");
+		}
+		for (i = 0; i < n; i++)
+			if ((w = evs[i].data.ptr)->func)
+				w->func(w->fd);
+	}
 }
 
 void scan(void) {
   /*! \brief Create clients for all visible or iconified windows.
-  **/
-
-	unsigned int i, num;
-	Window d1, d2, *wins = NULL;
-	XWindowAttributes wa;
+   *
+   * Attributes, geometry, WM_STATE and WM_TRANSIENT_FOR of all children are
+   * requested at once, then the properties manage() needs for every window
+   * to be adopted, so this takes the same few round trips for any number of windows.
+  **/
+
+	unsigned int i, j, num;
+	Window d1, d2, *wins = NULL, *pw;
+	Atom* pa;
+	Prop** r;
+	XWindowAttributes* wa;
+	xcb_get_window_attributes_cookie_t* ac;
+	xcb_get_geometry_cookie_t* gc;
+	xcb_get_window_attributes_reply_t* ar;
+	xcb_get_geometry_reply_t* gr;
+	xcb_generic_error_t* ae, *ge;
+	Monitor* m;
+	uint32_t* v;
+	char* kind;
 
-	if (XQueryTree(dpy, root, &d1, &d2, &wins, &num)) { //get list and number of children of root window
-		for (i = 0; i < num; i++) {
-			if (!XGetWindowAttributes(dpy, wins[i], &wa)
-			|| wa.override_redirect || XGetTransientForHint(dpy, wins[i], &d1))
-				continue; //skip transient windows, windows that want to be left alone, and those which attributes cannot be obtained
-			if (wa.map_state == IsViewable || getstate(wins[i]) == IconicState) //if visible (must manage window) or iconified (must manage iconic window)
-				manage(wins[i], &wa);
+	nsyncs++;
+	if (!XQueryTree(dpy, root, &d1, &d2, &wins, &num)) //get list and number of children of root window
+		return;
+	ac = ecalloc(num + 1, sizeof(*ac));
+	gc = ecalloc(num + 1, sizeof(*gc));
+	wa = ecalloc(num + 1, sizeof(*wa));
+	kind = ecalloc(num + 1, sizeof(*kind)); //0 means skip, 1 top-level window, 2 transient window
+	pw = ecalloc(num * PropLast + 1, sizeof(*pw));
+	pa = ecalloc(num * PropLast + 1, sizeof(*pa));
+	r = ecalloc(num * PropLast + 1, sizeof(*r));
+
+	for (i = 0; i < num; i++) { //send all requests before waiting for any reply
+		ac[i] = xcb_get_window_attributes(xcon, wins[i]);
+		gc[i] = xcb_get_geometry(xcon, wins[i]);
+		pw[2 * i] = pw[2 * i + 1] = wins[i];
+		pa[2 * i] = wmatom[WMState];
+		pa[2 * i + 1] = XA_WM_TRANSIENT_FOR;
+	}
+	getprops(pw, pa, 2 * num, r);
+	for (i = 0; i < num; i++) {
+		ar = xcb_get_window_attributes_reply(xcon, ac[i], &ae);
+		gr = xcb_get_geometry_reply(xcon, gc[i], &ge);
+		free(ae); //the window may have been destroyed since XQueryTree(), then it is skipped
+		free(ge);
+		if (ar && gr && (ar->map_state == XCB_MAP_STATE_VIEWABLE
+		|| ((v = propdata(r[2 * i], wmatom[WMState], 32, 1)) && *v == IconicState))) { //if visible (must manage window) or iconified (must manage iconic window)
+			if (propdata(r[2 * i + 1], XA_WINDOW, 32, 1))
+				kind[i] = 2; //transient windows (e.g. dialog boxes) are adopted last
+			else if (!ar->override_redirect) //skip windows that want to be left alone
+				kind[i] = 1;
+			wa[i].x = gr->x;
+			wa[i].y = gr->y;
+			wa[i].width = gr->width;
+			wa[i].height = gr->height;
+			wa[i].border_width = gr->border_width;
+			wa[i].map_state = ar->map_state;
+			wa[i].override_redirect = ar->override_redirect;
 		}
-		for (i = 0; i < num; i++) { /* now the transients (e.g. dialog boxes)*/
-			if (!XGetWindowAttributes(dpy, wins[i], &wa))
-				continue;
-			if (XGetTransientForHint(dpy, wins[i], &d1)
-			&& (wa.map_state == IsViewable || getstate(wins[i]) == IconicState)) //if visible (must manage window) or iconified (must manage iconic window)
-				manage(wins[i], &wa);
+		free(ar);
+		free(gr);
+		free(r[2 * i]);
+		free(r[2 * i + 1]);
+	}
+
+	for (i = j = 0; i < num; i++) //request properties of adopted windows, packed together
+		if (kind[i]) {
+			clientprops(wins[i], &pw[j * PropLast], &pa[j * PropLast]);
+			j++;
 		}
-		if (wins)
-			XFree(wins);
+	getprops(pw, pa, j * PropLast, r);
+	adopting = 1; //arrange and focus only once, below
+	for (i = j = 0; i < num; j += kind[i++] != 0) //top-level windows first, so that transients find their parents
+		if (kind[i] == 1)
+			manage(wins[i], &wa[i], &r[j * PropLast]);
+	for (i = j = 0; i < num; j += kind[i++] != 0)
+		if (kind[i] == 2)
+			manage(wins[i], &wa[i], &r[j * PropLast]);
+	adopting = 0;
+	for (i = 0; i < j * PropLast; i++)
+		free(r[i]);
+	if (j) {
+		for (m = mons; m; m = m->next) //restack too, as manage() would have
+			arrange(m);
+		updateclientlist();
+		focus(NULL); //the bars are repainted along with the layout, in commit()
+	}
+
+	free(ac);
+	free(gc);
+	free(wa);
+	free(kind);
+	free(pw);
+	free(pa);
+	free(r);
+	if (wins)
+		XFree(wins);
+}
+
+void sendgeom(Client* c) {
+  /*! \brief Configure a client's window, sending only what changed since last time.
+   *
+   * No synthetic ConfigureNotify is sent: the window is a child of the root
+   * window, so the real one is correct. The ICCCM only requires synthetic
+   * ones in reply to a ConfigureRequest, see configurerequest(); if the
+   * client asked for this geometry and nothing is sent, it gets one then.
+   *
+   * \sa flushgeom(), queuegeom()
+  **/
+
+	XWindowChanges wc;
+	unsigned int mask = 0;
+	int requested;
+
+	requested = c->isrequested;
+	c->ispending = c->isrequested = 0;
+	npending--;
+	wc.x = c->ishidden ? WIDTH(c) * -2 : c->x; //keep hidden windows out of the screen
+	wc.y = c->y;
+	wc.width = c->w;
+	wc.height = c->h;
+	wc.border_width = c->bw;
+	if (wc.x != c->cx)
+		mask |= CWX;
+	if (wc.y != c->cy)
+		mask |= CWY;
+	if (wc.width != c->cw)
+		mask |= CWWidth;
+	if (wc.height != c->ch)
+		mask |= CWHeight;
+	if (wc.border_width != c->cbw)
+		mask |= CWBorderWidth;
+	if (!mask) { //moved back to where it was
+		nunchanged++;
+		if (requested) //the client still expects a ConfigureNotify
+			configure(c);
+		return;
 	}
+	XConfigureWindow(dpy, c->win, mask, &wc);
+	c->cx = wc.x;
+	c->cy = wc.y;
+	c->cw = wc.width;
+	c->ch = wc.height;
+	c->cbw = wc.border_width;
+	nconfigures++;
 }
 
 void sendmon(Client* c, Monitor* m) {
@@ -1625,6 +2671,8 @@ void sendmon(Client* c, Monitor* m) {
 	if (c->mon == m)
 		return;
 	unfocus(c, 1);
+	arrange(c->mon); //only the source and target monitors change
+	c->mon->raised = m->raised = None; //it may have been the raised one, and it may now be above the other
 	detach(c);
 	detachstack(c);
 	c->mon = m;
@@ -1632,7 +2680,7 @@ void sendmon(Client* c, Monitor* m) {
 	attach(c);
 	attachstack(c);
 	focus(NULL); //focus the first visible window in the selected monitor
-	arrange(NULL);
+	arrange(m);
 }
 
 void setclientstate(Client* c, long state) {
@@ -1657,6 +2705,7 @@ int sendevent(Client* c, Atom proto) {
 	int exists = 0;
 	XEvent ev;
 
+	nsyncs++;
 	if (XGetWMProtocols(dpy, c->win, &protocols, &n)) { //get list of protocols that the window will accept
 		while (!exists && n--) //search for proto in list
 			exists = protocols[n] == proto;
@@ -1688,6 +2737,14 @@ void setfocus(Client* c) {
 	sendevent(c, wmatom[WMTakeFocus]); //notify the window
 }
 
+void setfloating(Client* c, int floating) {
+  /*! \brief Make a client floating or tiled, invalidating its monitor's Monitor::tiled.
+  **/
+
+	c->isfloating = floating;
+	c->mon->tiledvalid = 0;
+}
+
 void setfullscreen(Client* c, int fullscreen) {
   /*! \brief Sets a client window's fullscreen status.
    *
@@ -1699,21 +2756,21 @@ void setfullscreen(Client* c, int fullscreen) {
 			PropModeReplace, (unsigned char*)&netatom[NetWMFullscreen], 1); //make the window fullscreen
 		c->isfullscreen = 1;
 		c->oldstate = c->isfloating;
-		c->oldbw = c->bw;
+		c->info->oldbw = c->bw;
 		c->bw = 0;
-		c->isfloating = 1;
+		setfloating(c, 1);
 		resizeclient(c, c->mon->mx, c->mon->my, c->mon->mw, c->mon->mh);
-		XRaiseWindow(dpy, c->win); //hide all other windows
+		raiseclient(c); //hide all other windows
 	} else if (!fullscreen && c->isfullscreen){ //must stop being fullscreen
 		XChangeProperty(dpy, c->win, netatom[NetWMState], XA_ATOM, 32,
 			PropModeReplace, (unsigned char*)0, 0); //make it not fulscreen
 		c->isfullscreen = 0;
-		c->isfloating = c->oldstate;
-		c->bw = c->oldbw;
-		c->x = c->oldx;
-		c->y = c->oldy;
-		c->w = c->oldw;
-		c->h = c->oldh;
+		setfloating(c, c->oldstate);
+		c->bw = c->info->oldbw;
+		c->x = c->info->oldx;
+		c->y = c->info->oldy;
+		c->w = c->info->oldw;
+		c->h = c->info->oldh;
 		resizeclient(c, c->x, c->y, c->w, c->h);
 		arrange(c->mon);
 	}
@@ -1739,7 +2796,7 @@ void setlayout(const Arg* arg) {
 	if (selmon->sel) //if there is a selected client
 		arrange(selmon); //apply layout (also draws the bar)
 	else
-		drawbar(selmon); //only draw the bar
+		selmon->dirty |= DirtyBar; //only draw the bar
 }
 
 /* arg > 1.0 will set mfact absolutely */
@@ -1762,6 +2819,96 @@ void setmfact(const Arg* arg) {
 	arrange(selmon);
 }
 
+void setsizehints(Client* c, Prop* r) {
+  /*! \brief Set a client's size hints from the WM_NORMAL_HINTS property of its window.
+   * \sa updatesizehints(), applysizehints()
+  **/
+
+	int32_t* v;
+	XSizeHints size = { .flags = PSize }; //ignore all hints, unless there are some
+
+	if ((v = propdata(r, XA_WM_SIZE_HINTS, 32, 15))) { //see ICCCM 4.1.2.3
+		size.flags = v[0];
+		size.min_width = v[5];
+		size.min_height = v[6];
+		size.max_width = v[7];
+		size.max_height = v[8];
+		size.width_inc = v[9];
+		size.height_inc = v[10];
+		size.min_aspect.x = v[11];
+		size.min_aspect.y = v[12];
+		size.max_aspect.x = v[13];
+		size.max_aspect.y = v[14];
+		if (r->value_len >= 17) {
+			size.base_width = v[15];
+			size.base_height = v[16];
+		} else //pre-ICCCM version of the property
+			size.flags &= ~PBaseSize;
+	}
+	if (size.flags & PBaseSize) {
+		c->info->basew = size.base_width;
+		c->info->baseh = size.base_height;
+	} else if (size.flags & PMinSize) {
+		c->info->basew = size.min_width;
+		c->info->baseh = size.min_height;
+	} else
+		c->info->basew = c->info->baseh = 0;
+	if (size.flags & PResizeInc) {
+		c->info->incw = size.width_inc;
+		c->info->inch = size.height_inc;
+	} else
+		c->info->incw = c->info->inch = 0;
+	if (size.flags & PMaxSize) {
+		c->info->maxw = size.max_width;
+		c->info->maxh = size.max_height;
+	} else
+		c->info->maxw = c->info->maxh = 0;
+	if (size.flags & PMinSize) {
+		c->info->minw = size.min_width;
+		c->info->minh = size.min_height;
+	} else if (size.flags & PBaseSize) {
+		c->info->minw = size.base_width;
+		c->info->minh = size.base_height;
+	} else
+		c->info->minw = c->info->minh = 0;
+	if (size.flags & PAspect) {
+		c->info->mina = (float)size.min_aspect.y / size.min_aspect.x;
+		c->info->maxa = (float)size.max_aspect.x / size.max_aspect.y;
+	} else
+		c->info->maxa = c->info->mina = 0.0;
+	c->isfixed = (c->info->maxw && c->info->maxh && c->info->maxw == c->info->minw && c->info->maxh == c->info->minh); //the client size is fixed
+	geomgen++; //layouts must apply the new hints
+}
+
+void settags(Client* c, unsigned int tags) {
+  /*! \brief Change the tags of a client, keeping its monitor's counts up to date.
+   * \sa countclient()
+  **/
+
+	countclient(c, -1);
+	c->tags = tags;
+	countclient(c, 1);
+	c->mon->tiledvalid = 0;
+}
+
+void settitle(Client* c, Prop* netname, Prop* name) {
+  /*! \brief Set client name from the _NET_WM_NAME property of its window, or from WM_NAME.
+   * \sa updatetitle()
+  **/
+
+	char* t;
+
+	if (!(t = proptext(netname)))
+		t = proptext(name);
+	if (!t || t[0] == '\0') { /* hack to mark broken clients */
+		free(t);
+		t = ecalloc(sizeof broken, 1);
+		strcpy(t, broken);
+	}
+	free(c->info->name);
+	c->info->name = t; //as long as the window says, not truncated
+}
+
 void setup(void) {
   /*! \brief Initialization routine.
   **/
@@ -1770,16 +2917,32 @@ void setup(void) {
 	XSetWindowAttributes wa;
 	Atom utf8string;
 
+	/* receive signals through the main loop */
+	if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+		die("epoll_create1:");
+	addwatch(ConnectionNumber(dpy), NULL); //handled by xevents()
+	sigemptyset(&sigmask);
+	sigaddset(&sigmask, SIGCHLD);
+	sigaddset(&sigmask, SIGHUP);
+	sigaddset(&sigmask, SIGTERM);
+	if (sigprocmask(SIG_BLOCK, &sigmask, NULL) < 0)
+		die("sigprocmask:");
+	if ((i = signalfd(-1, &sigmask, SFD_NONBLOCK|SFD_CLOEXEC)) < 0)
+		die("signalfd:");
+	addwatch(i, signals);
 	/* clean up any zombies immediately */
-	sigchld(0);
+	while (0 < waitpid(-1, NULL, WNOHANG));
+	if (showstats && statsinterval)
+		addtimer(statsinterval * 1000, statstimer);
 
 	/* init screen */
 	screen = DefaultScreen(dpy); //get default open screen number
 	sw = DisplayWidth(dpy, screen);
 	sh = DisplayHeight(dpy, screen);
 	root = RootWindow(dpy, screen);
-	drw = drw_create(dpy, screen, root, sw, sh);
-	if (!drw_fontset_create(drw, fonts, LENGTH(fonts)))
+	xcon = XGetXCBConnection(dpy);
+	drw = drw_create(dpy, screen, root, 0, 0); //each bar draws into its own buffer
+	if (!drw_fontset_create(drw, fonts, LENGTH(fonts), maxfallbackfonts))
 		die("no fonts could be loaded.");
 	lrpad = drw->fonts->h; //left + right font padding = font height
 	bh = drw->fonts->h + 2;
@@ -1799,6 +2962,7 @@ void setup(void) {
 	netatom[NetWMWindowType] = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE", False);
 	netatom[NetWMWindowTypeDialog] = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_DIALOG", False);
 	netatom[NetClientList] = XInternAtom(dpy, "_NET_CLIENT_LIST", False);
+	netatom[NetClientListStacking] = XInternAtom(dpy, "_NET_CLIENT_LIST_STACKING", False);
 	/* init cursors */
 	cursor[CurNormal] = drw_cur_create(drw, XC_left_ptr); //standard arrow cursor
 	cursor[CurResize] = drw_cur_create(drw, XC_sizing); //resizing cursor
@@ -1822,6 +2986,7 @@ void setup(void) {
 	XChangeProperty(dpy, root, netatom[NetSupported], XA_ATOM, 32,
 		PropModeReplace, (unsigned char*) netatom, NetLast); //set _NET_SUPPORTED property of root to list of EWMH atoms it supports
 	XDeleteProperty(dpy, root, netatom[NetClientList]); //empty list of managed X windows
+	XDeleteProperty(dpy, root, netatom[NetClientListStacking]);
 	/* select events */
 	wa.cursor = cursor[CurNormal]->cursor; //set normal cursor for root
 	wa.event_mask = SubstructureRedirectMask|SubstructureNotifyMask //get events related to child window creation, destruction, resizing, mapping...
@@ -1840,7 +3005,10 @@ void seturgent(Client* c, int urg) {
 
 	XWMHints* wmh;
 
+	countclient(c, -1);
 	c->isurgent = urg;
+	countclient(c, 1);
+	nsyncs++;
 	if (!(wmh = XGetWMHints(dpy, c->win))) //try to get WM hints for the specified client's window
 		return;
 	wmh->flags = urg ? (wmh->flags | XUrgencyHint) : (wmh->flags & ~XUrgencyHint); //set/unset XUrgencyHint flag
@@ -1848,34 +3016,112 @@ void seturgent(Client* c, int urg) {
 	XFree(wmh);
 }
 
+void setwindowtype(Client* c, Prop* state, Prop* wtype) {
+  /*! \brief Set client's fullscreen or floating status from the _NET_WM_STATE
+   * and _NET_WM_WINDOW_TYPE properties of its window.
+   * \sa updatewindowtype()
+  **/
+
+	uint32_t* v;
+
+	if ((v = propdata(state, XA_ATOM, 32, 1)) && *v == netatom[NetWMFullscreen])
+		setfullscreen(c, 1);
+	if ((v = propdata(wtype, XA_ATOM, 32, 1)) && *v == netatom[NetWMWindowTypeDialog])
+		setfloating(c, 1);
+}
+
+void setwmhints(Client* c, Prop* r) {
+  /*! \brief Set a client's Client::isurgent and Client::neverfocus values from the WM_HINTS property of its window.
+   * \sa updatewmhints()
+  **/
+
+	int32_t* v;
+	XWMHints wmh;
+
+	if (!(v = propdata(r, XA_WM_HINTS, 32, 8))) //no valid WM_HINTS property
+		return;
+	wmh.flags = v[0];
+	wmh.input = v[1];
+	wmh.initial_state = v[2];
+	wmh.icon_pixmap = (uint32_t)v[3];
+	wmh.icon_window = (uint32_t)v[4];
+	wmh.icon_x = v[5];
+	wmh.icon_y = v[6];
+	wmh.icon_mask = (uint32_t)v[7];
+	wmh.window_group = r->value_len >= 9 ? (uint32_t)v[8] : None; //pre-ICCCM version of the property lacks it
+	if (c == selmon->sel && wmh.flags & XUrgencyHint) { //the window is selected but wants attention
+		wmh.flags &= ~XUrgencyHint; //it already has
+		XSetWMHints(dpy, c->win, &wmh); //tell it so
+	} else {
+		countclient(c, -1);
+		c->isurgent = (wmh.flags & XUrgencyHint) ? 1 : 0;
+		countclient(c, 1);
+	}
+	if (wmh.flags & InputHint) //client has input mode hint
+		c->neverfocus = !wmh.input; //if client doesn't expect input, or expects it but doesn't want the WM to give it input focus (gets input by itself)
+	else
+		c->neverfocus = 0;
+}
+
 void showhide(Client* c) {
   /*! \brief Apply visibility of all clients in a stack, placing them inside or outside the screen.
+   *
+   * Only windows whose visibility changed since the last call are moved, as
+   * tracked by Client::ishidden, so switching tags costs as many requests as
+   * clients appear or disappear. They are actually moved by flushgeom().
   **/
 
-	if (!c)
-		return;
-	if (ISVISIBLE(c)) { //if at least one tag of this window is selected
-		/* show clients top down */
-		XMoveWindow(dpy, c->win, c->x, c->y); //move it into the screen
+	Client* last = NULL;
+
+	/* show clients top down */
+	for (; c; c = c->snext) {
+		last = c;
+		if (!ISVISIBLE(c)) //no tag of this window is selected
+			continue;
+		if (c->ishidden) {
+			c->ishidden = 0; //move it into the screen
+			queuegeom(c);
+		}
 		if ((!c->mon->lt[c->mon->sellt]->arrange || c->isfloating) && !c->isfullscreen) //if floating but not fullscreen
-			resize(c, c->x, c->y, c->w, c->h, 0);
-		showhide(c->snext); //recursively show next client
-	} else {
-		/* hide clients bottom up */
-		showhide(c->snext); //recursively hide next client
-		XMoveWindow(dpy, c->win, WIDTH(c) * -2, c->y); //take it out of the screen
+			resize(c, c->x, c->y, c->w, c->h, 0); //only reconfigured if its size hints changed it
+	}
+	/* hide clients bottom up */
+	for (c = last; c; c = c->sprev)
+		if (!ISVISIBLE(c) && !c->ishidden) {
+			c->ishidden = 1; //take it out of the screen
+			queuegeom(c);
+		}
+}
+
+void signals(int fd) {
+  /*! \brief Handle signals in #sigmask, read from a signalfd(2).
+   *
+   * Terminated child processes are removed from the process table; SIGHUP and
+   * SIGTERM make dwm quit cleanly.
+  **/
+
+	struct signalfd_siginfo si;
+
+	while (read(fd, &si, sizeof si) == sizeof si) {
+		if (si.ssi_signo == SIGCHLD)
+			while (0 < waitpid(-1, NULL, WNOHANG)); //let the system reap any terminated child processes
+		else
+			running = 0;
 	}
 }
 
-void sigchld(int unused) {
-  /*! \brief This function sets itself as the handler for SIGCHLD signals.
-   * Whenever a child process terminates, it will be removed from the process
-   * table. It need only be called once at startup.
+void skipenters(void) {
+  /*! \brief Remove all pending EnterNotify events, both from the X queue and
+   * from the undispatched part of the batch in #evq.
   **/
 
-	if (signal(SIGCHLD, sigchld) == SIG_ERR) //set itself as handler for SIGCHLD
-		die("can't install SIGCHLD handler:");
-	while (0 < waitpid(-1, NULL, WNOHANG)); //let the system reap any terminated child processes
+	unsigned int i;
+	XEvent ev;
+
+	while (XCheckMaskEvent(dpy, EnterWindowMask, &ev));
+	for (i = evqpos + 1; i < evqlen; i++)
+		if (evq[i].type == EnterNotify)
+			evq[i].type = 0;
 }
 
 void spawn(const Arg* arg) {
@@ -1896,6 +3142,7 @@ void spawn(const Arg* arg) {
     /* we are in the child process */
 		if (dpy)
 			close(ConnectionNumber(dpy)); //close connection with the X server
+		sigprocmask(SIG_UNBLOCK, &sigmask, NULL); //the new program expects default signal delivery
 		setsid(); //start a new session
 		execvp(((char**)arg->v)[0], (char**)arg->v); //execute some command
     /* we are not running the new program, so an error occurred */
@@ -1905,6 +3152,16 @@ void spawn(const Arg* arg) {
 	}
 }
 
+void statstimer(int fd) {
+  /*! \brief Timer callback to print performance counters every #statsinterval seconds.
+  **/
+
+	uint64_t n;
+
+	if (read(fd, &n, sizeof n) == sizeof n)
+		printstats();
+}
+
 void tag(const Arg* arg) {
   /*! \brief Replace the selected window's tags.
    * \param arg [in] Its Arg::ui field must contain the new tags to apply.
@@ -1915,7 +3172,7 @@ void tag(const Arg* arg) {
   **/
 
 	if (selmon->sel && arg->ui & TAGMASK) { //if we are applying at least one tag to the selected window
-		selmon->sel->tags = arg->ui & TAGMASK;
+		settags(selmon->sel, arg->ui & TAGMASK);
 		focus(NULL); //focus the first visible window in the selected monitor
 		arrange(selmon);
 	}
@@ -1935,15 +3192,14 @@ void tagmon(const Arg* arg) {
 	sendmon(selmon->sel, dirtomon(arg->i)); //send the selected window in that direction
 }
 
-void tile(Monitor* m) {
+void tile(Monitor* m, Client** tiled, unsigned int n) {
   /*! \brief Arrange callback for the tiled layout.
    * \sa layouts
   **/
 
-	unsigned int i, n, h, mw, my, ty;
+	unsigned int i, h, mw, my, ty;
 	Client* c;
 
-	for (n = 0, c = nexttiled(m->clients); c; c = nexttiled(c->next), n++); //count the number of tiled windows
 	if (n == 0)
 		return;
 
@@ -1951,7 +3207,8 @@ void tile(Monitor* m) {
 		mw = m->nmaster ? m->ww * m->mfact : 0; //set master area width
 	else
 		mw = m->ww; //master will fill whole space
-	for (i = my = ty = 0, c = nexttiled(m->clients); c; c = nexttiled(c->next), i++) //for every tiled window
+	for (i = my = ty = 0; i < n; i++) { //for every tiled window
+		c = tiled[i];
 		if (i < m->nmaster) { //put it in master area
 			h = (m->wh - my) / (MIN(n, m->nmaster) - i); //calculate window height
 			resize(c, m->wx, m->wy + my, mw - (2*c->bw), h - (2*c->bw), 0);
@@ -1961,6 +3218,7 @@ void tile(Monitor* m) {
 			resize(c, m->wx + mw, m->wy + ty, m->ww - mw - (2*c->bw), h - (2*c->bw), 0);
 			ty += HEIGHT(c); //next stack window's position
 		}
+	}
 }
 
 void togglebar(const Arg* arg) {
@@ -1983,7 +3241,7 @@ void togglefloating(const Arg* arg) {
 		return;
 	if (selmon->sel->isfullscreen) /* no support for fullscreen windows */
 		return;
-	selmon->sel->isfloating = !selmon->sel->isfloating || selmon->sel->isfixed;
+	setfloating(selmon->sel, !selmon->sel->isfloating || selmon->sel->isfixed);
 	if (selmon->sel->isfloating)
 		resize(selmon->sel, selmon->sel->x, selmon->sel->y,
 			selmon->sel->w, selmon->sel->h, 0); //resize to its true size (i.e. taking size hints into account)
@@ -2006,7 +3264,7 @@ void toggletag(const Arg* arg) {
 		return;
 	newtags = selmon->sel->tags ^ (arg->ui & TAGMASK);
 	if (newtags) { //must contain at least one tag
-		selmon->sel->tags = newtags;
+		settags(selmon->sel, newtags);
 		focus(NULL);
 		arrange(selmon);
 	}
@@ -2026,6 +3284,7 @@ void toggleview(const Arg* arg) {
 
 	if (newtagset) { //must contain at least one tag
 		selmon->tagset[selmon->seltags] = newtagset;
+		selmon->tiledvalid = 0;
 		focus(NULL);
 		arrange(selmon);
 	}
@@ -2047,6 +3306,36 @@ void unfocus(Client* c, int setfocus) {
 	}
 }
 
+void unhashwin(Window w) {
+  /*! \brief Remove a window from #wintab, if present.
+   *
+   * Later entries of the same probe sequence are moved back into the freed
+   * slot, so that lookups never need to skip deleted entries.
+   *
+   * \sa hashwin()
+  **/
+
+	unsigned int i, j, k;
+	WinSlot* s;
+
+	if (!(s = findwin(w)))
+		return;
+	i = j = s - wintab;
+	for (;;) {
+		wintab[i].win = None;
+		do {
+			j = (j + 1) & (wintabsize - 1);
+			if (wintab[j].win == None) {
+				wintablen--;
+				return;
+			}
+			k = WINHASH(wintab[j].win);
+		} while (i <= j ? (i < k && k <= j) : (i < k || k <= j)); //entry at j can stay if its preferred slot is in (i, j]
+		wintab[i] = wintab[j];
+		i = j;
+	}
+}
+
 void unmanage(Client* c, int destroyed) {
   /*! \brief Remove a client from the WM.
    * \param c [in] The client to unmanage.
@@ -2060,17 +3349,17 @@ void unmanage(Client* c, int destroyed) {
 	detach(c);
 	detachstack(c);
 	if (!destroyed) { //only withdraw window
-		wc.border_width = c->oldbw;
+		wc.border_width = c->info->oldbw;
 		XGrabServer(dpy); /* avoid race conditions */
 		XSetErrorHandler(xerrordummy);
 		XConfigureWindow(dpy, c->win, CWBorderWidth, &wc); /* restore border */
 		XUngrabButton(dpy, AnyButton, AnyModifier, c->win);
 		setclientstate(c, WithdrawnState);
-		XSync(dpy, False);
+		xsync();
 		XSetErrorHandler(xerror);
 		XUngrabServer(dpy);
 	}
-	free(c);
+	freeclient(c);
 	focus(NULL); //focus the first visible window in the selected monitor
 	updateclientlist();
 	arrange(m);
@@ -2094,6 +3383,9 @@ void unmapnotify(XEvent* e) {
 
 void updatebars(void) {
   /*! \brief Create a bar for every monitor that doesn't have one.
+   *
+   * Also sizes every monitor's bar buffer to its window area width; a buffer
+   * whose size changed must be drawn again.
   **/
 
 	Monitor* m;
@@ -2104,6 +3396,12 @@ void updatebars(void) {
 	};
 	XClassHint ch = {"dwm", "dwm"}; //application name and class
 	for (m = mons; m; m = m->next) { //make sure every monitor has a bar
+		if (!m->barbuf)
+			m->barbuf = drw_buf_create(drw, m->ww, bh);
+		else if (m->barbuf->w != (unsigned int) m->ww) {
+			drw_buf_resize(drw, m->barbuf, m->ww, bh);
+			memset(m->barkeys, 0, sizeof m->barkeys); //its contents are lost
+		}
 		if (m->barwin) //skip already-existing bars
 			continue;
 		m->barwin = XCreateWindow(dpy, root, m->wx, m->by, m->ww, bh, /*border_width:*/ 0, DefaultDepth(dpy, screen),
@@ -2112,6 +3410,7 @@ void updatebars(void) {
 		XDefineCursor(dpy, m->barwin, cursor[CurNormal]->cursor); //set normal cursor for bar window
 		XMapRaised(dpy, m->barwin); //map bar and raise to top of stack
 		XSetClassHint(dpy, m->barwin, &ch); //set name and class defined before
+		hashwin(m->barwin, NULL, m);
 	}
 }
 
@@ -2135,13 +3434,20 @@ void updateclientlist() {
 
 	Client* c;
 	Monitor* m;
+	Window* wins;
+	int n = 0;
 
-	XDeleteProperty(dpy, root, netatom[NetClientList]);
 	for (m = mons; m; m = m->next)
 		for (c = m->clients; c; c = c->next)
-			XChangeProperty(dpy, root, netatom[NetClientList],
-				XA_WINDOW, 32, PropModeAppend,
-				(unsigned char*) &(c->win), 1);
+			n++;
+	wins = ecalloc(n + 1, sizeof(Window));
+	n = 0;
+	for (m = mons; m; m = m->next)
+		for (c = m->clients; c; c = c->next)
+			wins[n++] = c->win;
+	XChangeProperty(dpy, root, netatom[NetClientList], XA_WINDOW, 32, PropModeReplace,
+		(unsigned char*) wins, n); //replace the whole list in a single request
+	free(wins);
 }
 
 int updategeom(void) {
@@ -2195,7 +3501,7 @@ int updategeom(void) {
 				for (m = mons; m && m->next; m = m->next); //find last monitor
 				while ((c = m->clients)) { //for all clients in monitor to be removed
 					dirty = 1;
-					m->clients = c->next;
+					detach(c);
 					detachstack(c);
 					c->mon = mons; //attach to first available monitor
 					attach(c);
@@ -2234,6 +3540,7 @@ void updatenumlockmask(void) {
 	XModifierKeymap* modmap;
 
 	numlockmask = 0;
+	nsyncs++;
 	modmap = XGetModifierMapping(dpy); //get keys that are used as modifiers
   if(!modmap) //just in case...
     return;
@@ -2250,44 +3557,41 @@ void updatesizehints(Client* c) {
    * \sa applysizehints()
   **/
 
-	long msize;
-	XSizeHints size;
+	Atom a = XA_WM_NORMAL_HINTS;
+	Prop* r;
 
-	if (!XGetWMNormalHints(dpy, c->win, &size, &msize)) //get size hints
-		/* size is uninitialized, ensure that size.flags aren't used */
-		size.flags = PSize; //?? this will ignore any hints, won't it?
-	if (size.flags & PBaseSize) {
-		c->basew = size.base_width;
-		c->baseh = size.base_height;
-	} else if (size.flags & PMinSize) {
-		c->basew = size.min_width;
-		c->baseh = size.min_height;
-	} else
-		c->basew = c->baseh = 0;
-	if (size.flags & PResizeInc) {
-		c->incw = size.width_inc;
-		c->inch = size.height_inc;
-	} else
-		c->incw = c->inch = 0;
-	if (size.flags & PMaxSize) {
-		c->maxw = size.max_width;
-		c->maxh = size.max_height;
-	} else
-		c->maxw = c->maxh = 0;
-	if (size.flags & PMinSize) {
-		c->minw = size.min_width;
-		c->minh = size.min_height;
-	} else if (size.flags & PBaseSize) {
-		c->minw = size.base_width;
-		c->minh = size.base_height;
-	} else
-		c->minw = c->minh = 0;
-	if (size.flags & PAspect) {
-		c->mina = (float)size.min_aspect.y / size.min_aspect.x;
-		c->maxa = (float)size.max_aspect.x / size.max_aspect.y;
-	} else
-		c->maxa = c->mina = 0.0;
-	c->isfixed = (c->maxw && c->maxh && c->maxw == c->minw && c->maxh == c->minh); //the client size is fixed
+	getprops(&c->win, &a, 1, &r);
+	setsizehints(c, r);
+	free(r);
+}
+
+void updatestacking(void) {
+  /*! \brief Update the _NET_CLIENT_LIST_STACKING property of the root window.
+   *
+   * The list goes from bottom to top: on each monitor, tiled clients in
+   * reverse Monitor::stack order, then floating ones, the same way restack()
+   * stacks them.
+  **/
+
+	Client* c;
+	Monitor* m;
+	Window* wins;
+	int n = 0, floating;
+
+	for (m = mons; m; m = m->next)
+		for (c = m->clients; c; c = c->next)
+			n++;
+	wins = ecalloc(n + 1, sizeof(Window));
+	n = 0;
+	for (m = mons; m; m = m->next) {
+		for (floating = 0; floating < 2; floating++)
+			for (c = m->stail; c; c = c->sprev)
+				if (!c->isfloating == !floating)
+					wins[n++] = c->win;
+	}
+	XChangeProperty(dpy, root, netatom[NetClientListStacking], XA_WINDOW, 32, PropModeReplace,
+		(unsigned char*) wins, n);
+	free(wins);
 }
 
 void updatestatus(void) {
@@ -2296,50 +3600,75 @@ void updatestatus(void) {
 
 	if (!gettextprop(root, XA_WM_NAME, stext, sizeof(stext))) //get name of root window into stext
 		strcpy(stext, "dwm-"VERSION); //fallback
-	drawbar(selmon);
+	selmon->dirty |= DirtyBar;
+}
+
+void updatetiled(Monitor* m) {
+  /*! \brief Rebuild the array of visible tiled clients of a monitor.
+   *
+   * It is kept until tags, floating state, the tagset or the client list
+   * change, so layouts do not need to skip hidden or floating clients.
+   *
+   * \sa arrangemon()
+  **/
+
+	unsigned int n;
+	Client* c;
+
+	for (n = 0, c = m->clients; c; c = c->next, n++); //upper bound
+	if (n > m->tiledsize) {
+		free(m->tiled);
+		m->tiledsize = MAX(n, 2 * m->tiledsize);
+		m->tiled = ecalloc(m->tiledsize, sizeof(Client*));
+	}
+	m->ntiled = m->nvisible = 0;
+	for (c = m->clients; c; c = c->next)
+		if (ISVISIBLE(c)) {
+			m->nvisible++;
+			if (!c->isfloating)
+				m->tiled[m->ntiled++] = c;
+		}
+	m->tiledvalid = 1;
 }
 
 void updatetitle(Client* c) {
-  /*! \brief Set client name from its window's WM_NAME property.
+  /*! \brief Set client name from its window's _NET_WM_NAME or WM_NAME property.
   **/
 
-	if (!gettextprop(c->win, netatom[NetWMName], c->name, sizeof c->name))
-		gettextprop(c->win, XA_WM_NAME, c->name, sizeof c->name);
-	if (c->name[0] == '\0') /* hack to mark broken clients */
-		strcpy(c->name, broken);
+	Window w[] = { c->win, c->win };
+	Atom a[] = { netatom[NetWMName], XA_WM_NAME };
+	Prop* r[LENGTH(a)];
+
+	getprops(w, a, LENGTH(a), r);
+	settitle(c, r[0], r[1]);
+	free(r[0]);
+	free(r[1]);
 }
 
 void updatewindowtype(Client* c) {
   /*! \brief Set client's fullscreen or floating status if its window is fullscreen or a dialog.
   **/
 
-	Atom state = getatomprop(c, netatom[NetWMState]);
-	Atom wtype = getatomprop(c, netatom[NetWMWindowType]);
+	Window w[] = { c->win, c->win };
+	Atom a[] = { netatom[NetWMState], netatom[NetWMWindowType] };
+	Prop* r[LENGTH(a)];
 
-	if (state == netatom[NetWMFullscreen])
-		setfullscreen(c, 1);
-	if (wtype == netatom[NetWMWindowTypeDialog])
-		c->isfloating = 1;
+	getprops(w, a, LENGTH(a), r);
+	setwindowtype(c, r[0], r[1]);
+	free(r[0]);
+	free(r[1]);
 }
 
 void updatewmhints(Client* c) {
   /*! \brief Set a client's Client::isurgent and Client::neverfocus values according to its window's WM_HINT property.
   **/
 
-	XWMHints* wmh;
+	Atom a = XA_WM_HINTS;
+	Prop* r;
 
-	if ((wmh = XGetWMHints(dpy, c->win))) { //get the window's WM_HINTS property
-		if (c == selmon->sel && wmh->flags & XUrgencyHint) { //the window is selected but wants attention
-			wmh->flags &= ~XUrgencyHint; //it already has
-			XSetWMHints(dpy, c->win, wmh); //tell it so
-		} else
-			c->isurgent = (wmh->flags & XUrgencyHint) ? 1 : 0;
-		if (wmh->flags & InputHint) //client has input mode hint
-			c->neverfocus = !wmh->input; //if client doesn't expect input, or expects it but doesn't want the WM to give it input focus (gets input by itself)
-		else
-			c->neverfocus = 0;
-		XFree(wmh);
-	}
+	getprops(&c->win, &a, 1, &r);
+	setwmhints(c, r);
+	free(r);
 }
 
 void view(const Arg* arg) {
@@ -2355,6 +3684,7 @@ void view(const Arg* arg) {
 	selmon->seltags ^= 1; /* toggle sel tagset */
 	if (arg->ui & TAGMASK)
 		selmon->tagset[selmon->seltags] = arg->ui & TAGMASK; //select exactly those tags
+	selmon->tiledvalid = 0;
 	focus(NULL); //focus the first visible window in the selected monitor
 	arrange(selmon);
 }
@@ -2365,14 +3695,9 @@ Client* wintoclient(Window w) {
    * If there is none, returns NULL.
   **/
 
-	Client* c;
-	Monitor* m;
+	WinSlot* s = findwin(w);
 
-	for (m = mons; m; m = m->next) //for every monitor
-		for (c = m->clients; c; c = c->next) //for every client in monitor
-			if (c->win == w)
-				return c;
-	return NULL;
+	return s ? s->c : NULL;
 }
 
 Monitor* wintomon(Window w) {
@@ -2382,16 +3707,12 @@ Monitor* wintomon(Window w) {
   **/
 
 	int x, y; //pointer coordinates relative to root
-	Client* c;
-	Monitor* m;
+	WinSlot* s;
 
 	if (w == root && getrootptr(&x, &y))
 		return recttomon(x, y, 1, 1); //return monitor where the pointer is
-	for (m = mons; m; m = m->next)
-		if (w == m->barwin) //bar window in a monitor
-			return m;
-	if ((c = wintoclient(w))) //all other windows have clients
-		return c->mon;
+	if ((s = findwin(w))) //bar window in a monitor, or client window
+		return s->c ? s->c->mon : s->m;
 	return selmon; //fallback
 }
 
@@ -2418,6 +3739,40 @@ int xerror(Display* dpy, XErrorEvent* ee) {
 	return xerrorxlib(dpy, ee); /* may call exit */
 }
 
+void xevents(void) {
+  /*! \brief Dispatch pending X events in batches, until none are left.
+   *
+   * Each batch holds all pending events, or stops after user input, as its
+   * callbacks may run their own event loop (see movemouse()). Redundant events
+   * are coalesced (see queueevent()), the rest dispatched through #handler and
+   * the resulting updates applied once with commit().
+  **/
+
+	int type;
+	unsigned long requests, syncs;
+	XEvent ev;
+
+	while (running && XPending(dpy)) {
+		evqlen = 0;
+		do {
+			XNextEvent(dpy, &ev);
+			queueevent(&ev);
+		} while (ev.type != KeyPress && ev.type != ButtonPress
+		&& evqlen < LENGTH(evq) && XPending(dpy));
+		for (evqpos = 0; running && evqpos < evqlen; evqpos++) { //dispatch events that were not coalesced
+			if (!handler[type = evq[evqpos].type])
+				continue;
+			requests = XNextRequest(dpy);
+			syncs = nsyncs;
+			handler[type](&evq[evqpos]); /* call handler */
+			evstats[type].calls++;
+			evstats[type].requests += XNextRequest(dpy) - requests;
+			evstats[type].syncs += nsyncs - syncs;
+		}
+		commit();
+	}
+}
+
 int xerrordummy(Display* dpy, XErrorEvent* ee) {
   /*! \brief Dummy error handler.
   **/
@@ -2434,6 +3789,17 @@ int xerrorstart(Display* dpy, XErrorEvent* ee) {
 	return -1;
 }
 
+void xsync(void) {
+  /*! \brief Flush the output buffer and wait until all requests have been processed.
+   *
+   * This is a full round trip to the X server, so it is counted. Only use it
+   * where correctness requires it.
+  **/
+
+	nsyncs++;
+	XSync(dpy, False);
+}
+
 void zoom(const Arg* arg) {
   /*! \brief Toggle window between master and stack areas.
    *
@@ -2458,6 +3824,8 @@ int main(int argc, char* argv[]) {
   /*! \brief Entry point.
   **/
 
+	struct timespec t0, t1;
+
 	if (argc == 2 && !strcmp("-v", argv[1]))
 		die("dwm-"VERSION); //print version and exit
 	else if (argc != 1)
@@ -2467,9 +3835,17 @@ int main(int argc, char* argv[]) {
 	if (!(dpy = XOpenDisplay(NULL))) //try to open display from name set in DISPLAY environment variable
 		die("dwm: cannot open display");
 	checkotherwm();
+	clock_gettime(CLOCK_MONOTONIC, &t0);
 	setup();
 	scan();
+	if (showstats) { //report how long it took to become ready, including adopting existing windows
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		fprintf(stderr, "dwm: started in %.3f ms\n",
+			(t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6);
+	}
 	run();
+	if (showstats)
+		printstats();
 	cleanup();
 	XCloseDisplay(dpy);
 	return EXIT_SUCCESS;